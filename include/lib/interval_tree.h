@@ -0,0 +1,101 @@
+/* Interval tree class header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _INTERVAL_TREE_H_
+#define _INTERVAL_TREE_H_
+
+#include <lib/rbtree.h>
+#include <stdint.h>
+
+template <typename T>
+struct interval_traits
+{
+    struct data
+    {
+        uintptr_t max_end = 0;  /* largest end in the subtree */
+    };
+    static constexpr bool augmented = true;
+
+    static bool less(const T& a, const T& b) { return a.start < b.start; }
+    static bool equal(const T&, const T&) { return false; }
+    static void update(data& x, const T& k, const data& l, const data& r)
+    {
+        x.max_end = k.end;
+        if (l.max_end > x.max_end) x.max_end = l.max_end;
+        if (r.max_end > x.max_end) x.max_end = r.max_end;
+    }
+};
+
+/* red-black tree of half-open intervals [start, end), ordered by start, where
+   every node also keeps the largest end in its subtree; T must have the
+   members start and end. the interval of an element must not be changed
+   while it is in the tree (erase and insert it again instead) */
+template <typename T, template <class> class NodeBase = node_base>
+class interval_tree : public rbtree<T, interval_traits<T>, NodeBase>
+{
+    typedef rbtree<T, interval_traits<T>, NodeBase> base;
+    typedef typename base::node node;
+
+public:
+    typedef typename base::const_iterator const_iterator;
+
+    interval_tree() {}
+
+    interval_tree(const interval_tree& x) : base()
+    {
+        for (const auto& k : x)
+            this->insert(k);
+    }
+
+    interval_tree& operator=(const interval_tree& x)
+    {
+        if (this != &x) {
+            this->clear();
+            for (const auto& k : x)
+                this->insert(k);
+        }
+        return *this;
+    }
+
+    // the interval with the lowest start that overlaps [start, end)
+    const_iterator first_overlap(uintptr_t start, uintptr_t end) const
+    {
+        node* x = this->root;
+        node* nil = this->nil;
+        while (x != nil) {
+            // if nothing in the left subtree overlaps, nothing to the right
+            // does either whenever the left subtree reaches past start
+            if (x->l != nil && x->l->max_end > start)
+                x = x->l;
+            else if (x->key.start < end && x->key.end > start)
+                return const_iterator(x);
+            else if (x->key.start >= end)
+                break;
+            else
+                x = x->r;
+        }
+        return this->end();
+    }
+
+    // the interval containing addr
+    inline const_iterator find(uintptr_t addr) const
+    {
+        return first_overlap(addr, addr + 1);
+    }
+};
+
+
+#endif /* _INTERVAL_TREE_H_ */
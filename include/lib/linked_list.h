@@ -18,13 +18,14 @@
 #define _LINKED_LIST_H_
 
 #include <lib/klib.h>
+#include <lib/node_base.h>
 #include <iterator>
 
-template <class T>
+template <class T, template <class> class NodeBase = node_base>
 class linked_list
 {
 private:
-    struct node
+    struct node : NodeBase<node>
     {
         T key;
         node* nil;
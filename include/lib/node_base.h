@@ -0,0 +1,41 @@
+/* Default base class of container nodes.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _NODE_BASE_H_
+#define _NODE_BASE_H_
+
+#include <stddef.h>
+
+/* the containers derive their nodes from NodeBase<node>, which decides where
+   the nodes are allocated; this one uses the global operator new. a different
+   base (like the kernel's slab::cached) has to provide a noexcept operator
+   new as well, since the containers check its result */
+template <class Node>
+struct node_base
+{
+    // noexcept, so that new returns nullptr instead of constructing into it
+    static void* operator new(size_t sz) noexcept
+    {
+        return ::operator new(sz);
+    }
+
+    static void operator delete(void* p)
+    {
+        ::operator delete(p);
+    }
+};
+
+#endif /* _NODE_BASE_H_ */
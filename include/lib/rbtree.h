@@ -18,16 +18,34 @@
 #define _RBTREE_H_
 
 #include <lib/klib.h>
+#include <lib/node_base.h>
 #include <iterator>
 
+/* the ordering of the keys, and the data kept in every node besides the key.
+   an augmented tree (like interval_tree) computes the data of a node from its
+   key and the data of its children in update, which the tree calls whenever
+   the subtree below a node changes; the data of a default constructed data
+   is used for the leaves */
 template <typename T>
+struct rbtree_traits
+{
+    struct data {};
+    static constexpr bool augmented = false;
+
+    static bool less(const T& a, const T& b) { return a < b; }
+    static bool equal(const T& a, const T& b) { return a == b; }
+    static void update(data&, const T&, const data&, const data&) {}
+};
+
+template <typename T, typename Traits = rbtree_traits<T>,
+          template <class> class NodeBase = node_base>
 class rbtree
 {
-private:
+protected:
     static constexpr bool BLACK = false;
     static constexpr bool RED   = true;
 
-    struct node
+    struct node : NodeBase<node>, Traits::data
     {
         node* nil;
         T key;
@@ -118,7 +136,24 @@ private:
     node* nil;
     node* root;
 
-    size_t sz;
+    size_t sz = 0;
+
+    node* spare = nullptr;      /* nodes set aside by reserve(), linked through r */
+    size_t num_spare = 0;
+
+    inline void _update(node* x)
+    {
+        if (Traits::augmented)
+            Traits::update(*x, x->key, *x->l, *x->r);
+    }
+
+    // update the data of x and its ancestors
+    inline void _update_path(node* x)
+    {
+        if (Traits::augmented)
+            for (; x != nil; x = x->p)
+                _update(x);
+    }
 
 #define __RBTREE_DEF_ROTATE(a,b)        \
     void _##a##_rotate(node* x) \
@@ -132,6 +167,8 @@ private:
         else x->p->r = y; \
         y->a = x; \
         x->p = y; \
+        _update(x); \
+        _update(y); \
     }
 
     __RBTREE_DEF_ROTATE(l,r)
@@ -148,6 +185,7 @@ if (y->color == RED) { \
     z->p->color = BLACK; \
     y->color = BLACK; \
     z->p->p->color = RED; \
+    z = z->p->p; \
 } else { \
     if (z == z->p->a) { \
         z = z->p; \
@@ -223,13 +261,14 @@ public:
         const_iterator(node* x = nullptr) : n(x) {}
         const_iterator(void* handle) : n((node*)handle) {}
         const_iterator(const const_iterator& x) : n(x.n) {}
+        const_iterator& operator=(const const_iterator& x) { n = x.n; return *this; }
         const_iterator& operator++() { n = n->succ(); return *this; }
         const_iterator operator++(int) { const_iterator it(*this); n = n->succ(); return it; }
         const_iterator& operator--() { n = n->pred(); return *this; }
         const_iterator operator--(int) { const_iterator it(*this); n = n->pred(); return it; }
         const T& operator*() const { return n->key; }
         const T* operator->() const { return &n->key; }
-        T* get() const { return &n->key; }
+        T* get() const { return &n->key; } // do not change the ordering through this
         node* handle() const { return n; }
         bool operator==(const const_iterator& x) const { return n == x.n; }
         bool operator!=(const const_iterator& x) const { return n != x.n; }
@@ -245,12 +284,42 @@ public:
         root = nil;
     }
 
+    rbtree(const rbtree&) = delete;
+    rbtree& operator=(const rbtree&) = delete;
+
     ~rbtree()
     {
-        if (root) {
+        clear();
+        delete nil;
+    }
+
+    void clear()
+    {
+        if (root != nil)
             delete root;
-            if (nil != root) delete nil;
+        root = nil;
+        nil->p = nil;
+        sz = 0;
+        while (spare) {
+            node* x = spare;
+            spare = x->r;
+            x->l = x->r = nullptr;
+            delete x;
         }
+        num_spare = 0;
+    }
+
+    // set nodes aside, so that the next n inserts cannot fail; returns false if there is no memory
+    bool reserve(size_t n)
+    {
+        for (; num_spare < n; num_spare++) {
+            node* x = new node(nil);
+            if (unlikely(!x))
+                return false;
+            x->r = spare;
+            spare = x;
+        }
+        return true;
     }
 
     const_iterator begin() const
@@ -300,22 +369,37 @@ public:
         return const_iterator(root->upper_bound(k));
     }
 
+    // returns the element equal to k if there is one, or end() if there is no memory
     const_iterator insert(const T& k)
     {
-        node* z = new node(nil, k, RED, nil, nil);
         node* y = nil, *x = root;
         while (x != nil) {
             y = x;
-            if (k == x->key)
+            if (Traits::equal(k, x->key))
                 return const_iterator(x);
-            x = (k < x->key) ? x->l : x->r;
+            x = Traits::less(k, x->key) ? x->l : x->r;
+        }
+
+        node* z;
+        if (spare) {
+            z = spare;
+            spare = z->r;
+            num_spare--;
+            z->key = k;
+            z->color = RED;
+            z->l = z->r = nil;
+        } else {
+            z = new node(nil, k, RED, nil, nil);
+            if (unlikely(!z))
+                return end();
         }
         z->p = y;
 
         if (y == nil) root = z;
-        else if (k < y->key) y->l = z;
+        else if (Traits::less(k, y->key)) y->l = z;
         else y->r = z;
 
+        _update_path(z);
         _insert_fixup(z);
         sz++;
         return const_iterator(z);
@@ -351,6 +435,7 @@ public:
             y->color = z->color;
         }
 
+        _update_path(x->p);
         if (y_org_color == BLACK)
             _remove_fixup(x);
         z->l = z->r = nullptr;
@@ -18,10 +18,29 @@
 #define _VECTOR_H_
 
 #include <lib/klib.h>
+#include <lib/string.h>
 #include <new>
 #include <initializer_list>
 #include <limits>
 #include <utility>
+#include <type_traits>
+#include <memory>
+
+/* a type is trivially relocatable if moving an object to a new address and
+   forgetting the old one is the same as copying its bytes (true for most types
+   that are not self-referential, but it can only be detected for trivially
+   copyable ones; specialize this for others) */
+template <class T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+template <class T>
+struct is_trivially_relocatable<std::shared_ptr<T>> : std::true_type {};
+
+template <class T>
+struct is_trivially_relocatable<std::weak_ptr<T>> : std::true_type {};
+
+template <class T, class D>
+struct is_trivially_relocatable<std::unique_ptr<T, D>> : std::true_type {};
 
 // A dynamic vector supporting only push_back and pop_back
 
@@ -63,10 +82,28 @@ private:
             _membegin = _begin = _end = _memend = nullptr;
             return;
         }
+        const size_t sz = size();
+        if (is_trivially_relocatable<T>::value && _membegin) {
+            // move the elements to the front, and let realloc resize the
+            // buffer (in place if possible)
+            if (n < sz) {
+                _destroy(_begin + n, _end);
+                _end = _begin + n;
+            }
+            if (_begin != _membegin)
+                memmove(_membegin, _begin, (_end - _begin) * sizeof(T));
+            _end      = _membegin + (_end - _begin);
+            _begin    = _membegin;
+            const iterator mem = (iterator) realloc(_membegin, n * sizeof(T));
+            ASSERTH(mem != nullptr);
+            _end      = mem + (_end - _membegin);
+            _begin    = _membegin = mem;
+            _memend   = _membegin + n;
+            return;
+        }
         const iterator oldbegin = _begin;
         const iterator oldend   = _end;
         const iterator oldmem   = _membegin;
-        const size_t sz = size();
         _membegin = (iterator) malloc(n * sizeof(T));
         _memend   = _membegin + n;
         _end      = _membegin;
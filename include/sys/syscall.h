@@ -77,7 +77,7 @@ inline int name(atype1 a1, atype2 a2, atype3 a3, atype4 a4) \
 
 /* syscall declarations */
 _SYSCALL1(0, sys_exit, int, status)
-_SYSCALL1(1, sys_clone, uint32_t, flags)
+_SYSCALL2(1, sys_clone, uint32_t, flags, void*, child_stack)
 _SYSCALL0(2, sys_getpid)
 _SYSCALL3(3, sys_waitpid, pid_t, pid, int*, status, int, options)
 _SYSCALL2(4, sys_nanosleep, uint32_t, ns_low, uint32_t, ns_high)
@@ -87,5 +87,9 @@ _SYSCALL3(7, sys_read, int, fd, void*, buf, size_t, count)
 _SYSCALL3(8, sys_write, int, fd, const void*, buf, size_t, count)
 _SYSCALL3(9, sys_lseek, int, fd, off_t*, poffset, int, whence)
 _SYSCALL1(10, sys_brk, void*, addr)
+_SYSCALL4(11, sys_mmap, void*, addr, size_t, length, int, prot, int, flags)
+_SYSCALL2(12, sys_munmap, void*, addr, size_t, length)
+_SYSCALL3(13, sys_mprotect, void*, addr, size_t, length, int, prot)
+_SYSCALL0(14, sys_sched_yield)
 
 #endif  /* _SYS_SYSCALL_H_ */
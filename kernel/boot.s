@@ -26,6 +26,7 @@ CHECKSUM          equ -(HEADER_MAGIC + HEADER_FLAGS)
 
 KERNEL_VIRTUAL_BASE equ 0xC0000000                  ; start of kernel space
 KERNEL_PAGE_NUMBER  equ (KERNEL_VIRTUAL_BASE >> 22)
+PAE_PAGE_NUMBER     equ (KERNEL_VIRTUAL_BASE >> 21)
 
 bits 32
 
@@ -37,10 +38,29 @@ multiboot:  ; multiboot header
         dd HEADER_FLAGS
         dd CHECKSUM
 
+;; the layout of kernel_page_dir has to match paging::page_dir
 section .data
 align 0x1000
 global kernel_page_dir
 kernel_page_dir:
+%ifdef CONFIG_PAE
+    ; the four directories of the PDPT back to back, with 2 MiB pages;
+    ; the first 4 MiB are identity-mapped and mapped to 0xC0000000
+    dq 0x83
+    dq 0x200083
+    times (PAE_PAGE_NUMBER - 2) dq 0
+    dq 0x83
+    dq 0x200083
+    times (2048 - PAE_PAGE_NUMBER - 2) dq 0
+    times 2048 dd 0                                     ; table addresses
+kernel_pdpt:
+%assign k 0
+%rep 4
+    dd (kernel_page_dir - KERNEL_VIRTUAL_BASE + k*0x1000) + 1 ; (no 64-bit relocations in elf32)
+    dd 0
+%assign k k+1
+%endrep
+%else
     ; this page directory entry identity-maps the first 4 MiB of the 32-bit physical address space.
     ; it also maps the first 4 MiB to 0xC0000000
     dd 0x83
@@ -48,7 +68,7 @@ kernel_page_dir:
     dd 0x83
     times (1024 - KERNEL_PAGE_NUMBER - 1) dd 0          ; Pages after the kernel image.
     times 1024 dd 0                                     ; table addresses
-    dd (kernel_page_dir - KERNEL_VIRTUAL_BASE)          ; physical address of the page
+%endif
         
 section .text
 global _start
@@ -58,16 +78,25 @@ _start:
         cli
 
         ;; Setup paging for higher half kernel
+%ifdef CONFIG_PAE
+        mov edx, (kernel_pdpt - KERNEL_VIRTUAL_BASE)
+        mov cr3, edx
+
+        mov edx, cr4
+        or  edx, 0x00000630     ; enable PAE, large pages and OSFXSR & OSXMMEXCPT(SSE)
+        mov cr4, edx
+%else
         mov edx, (kernel_page_dir - KERNEL_VIRTUAL_BASE)
         mov cr3, edx
 
         mov edx, cr4
         or  edx, 0x00000610     ; enable 4 MiB pages and OSFXSR & OSXMMEXCPT(SSE)
         mov cr4, edx
+%endif
 
         mov edx, cr0
         and edx, 0xFFFB         ; disable EM bit (for SSE)
-        or  edx, 0x80000002     ; enable paging and MP (SSE)
+        or  edx, 0x80010002     ; enable paging, WP (for copy-on-write) and MP (SSE)
         mov cr0, edx
 
         fninit                  ; initialize FPU
@@ -77,8 +106,15 @@ _start:
 
 .higherhalf:
         ;; unmap the identity-mapped first 4MiB
+%ifdef CONFIG_PAE
+        mov dword [kernel_page_dir], 0
+        mov dword [kernel_page_dir+8], 0
+        invlpg [0]
+        invlpg [0x200000]
+%else
         mov dword [kernel_page_dir], 0
         invlpg [0]
+%endif
 
         mov  esp, _kstack_top      ; set up stack
 
@@ -19,13 +19,11 @@
 #include <console.h>
 #include <memory.h>
 #include <paging.h>
+#include <dma.h>
 #include <devices/pci.h>
 
 using std::unique_ptr;
 using std::make_unique;
-using memory::kmalloc;
-using memory::KMALLOC_ALIGN;
-using memory::KMALLOC_ZERO;
 
 namespace devices
 {
@@ -247,11 +245,25 @@ class ahci_driver : public block_driver
     volatile hba_port* port = nullptr;
 
     command_head* cmd_head = nullptr;
-    void* cmd_head_phys = nullptr;
-    command_table* cmd_table = nullptr;
-    void* cmd_table_phys = nullptr;
+    command_table* cmd_tables[NUM_CMD_SLOTS] = {};
     uint8_t* fis = nullptr;
-    void* fis_phys = nullptr;
+
+    /* the DMA structures of all ports (alignments from the AHCI spec) */
+    static dma::pool& cmd_list_pool()
+    {
+        static dma::pool p("ahci_cmd_list", sizeof(command_head) * NUM_CMD_SLOTS, 1024);
+        return p;
+    }
+    static dma::pool& cmd_table_pool()
+    {
+        static dma::pool p("ahci_cmd_table", sizeof(command_table), 128);
+        return p;
+    }
+    static dma::pool& fis_pool()
+    {
+        static dma::pool p("ahci_fis", 256, 256);
+        return p;
+    }
 
 public:
     ahci_driver(uint8_t portid, volatile hba_port* port)
@@ -262,28 +274,22 @@ public:
         if (!valid)
             return;
 
-        // TODO allocate DMA memory directly from frame allocator to
-        //      ensure physical continuity
-        kmalloc(sizeof(command_table) * NUM_CMD_SLOTS,
-                KMALLOC_ALIGN | KMALLOC_ZERO,
-                &cmd_table_phys);
-        kmalloc(sizeof(command_head) * 32,
-                KMALLOC_ALIGN | KMALLOC_ZERO,
-                &cmd_head_phys);
-        kmalloc(256, KMALLOC_ALIGN | KMALLOC_ZERO, &fis_phys);
-        cmd_head = (command_head*)memory::remap(cmd_head_phys, sizeof(command_head) * 32);
-        cmd_table = (command_table*)memory::remap(cmd_table_phys, sizeof(command_table) * NUM_CMD_SLOTS);
-        fis = (uint8_t*)memory::remap(fis_phys, 256);
+        dma::bus_addr_t cmd_head_bus, fis_bus;
+        cmd_head = (command_head*) cmd_list_pool().alloc(&cmd_head_bus);
+        fis = (uint8_t*) fis_pool().alloc(&fis_bus);
+        ASSERTH(cmd_head && fis);
 
         port->stop_engine();
 
-        port->command_list_base = (uint64_t)cmd_head_phys;
-        port->fis_base = (uint64_t)fis_phys;
+        port->command_list_base = cmd_head_bus;
+        port->fis_base = fis_bus;
 
         for (size_t i=0; i<NUM_CMD_SLOTS; i++) {
+            dma::bus_addr_t table_bus;
+            cmd_tables[i] = (command_table*) cmd_table_pool().alloc(&table_bus);
+            ASSERTH(cmd_tables[i] != nullptr);
             cmd_head[i].prdt_entries = NUM_PRDT_ENTRIES;
-            cmd_head[i].command_table_base = size_t(cmd_table_phys) +
-                sizeof(command_table) * i;
+            cmd_head[i].command_table_base = table_bus;
         }
 
         port->start_engine();
@@ -291,25 +297,26 @@ public:
         port->int_enable = ~0;
 
         // TEST read first 4 sectors (2KiB)
-        void* buf_phys = nullptr;
-        auto buf = (uint8_t*) kmalloc(2048, KMALLOC_ZERO, &buf_phys);
-        ASSERTH(!transfer(0, 4, (uint8_t*)buf_phys, false));
+        dma::bus_addr_t buf_bus;
+        auto buf = (uint8_t*) dma::alloc_coherent(2048, &buf_bus);
+        ASSERTH(buf && !transfer(0, 4, (uint8_t*)buf_bus, false));
 
         for (int i=0; i<256;) {
             for (int j=0;j<26 && i<256;j++,i++)
                 console::printf(j==25 ? "%02X" : "%02X ", buf[i]);
             console::put('\n');
         }
-        delete[] buf;
+        dma::free_coherent(buf, 2048);
         for (volatile int i=1<<28; i--; ) ; // Pause a bit
     }
 
     ~ahci_driver()
     {
         port->stop_engine();
-        //delete[] cmd_head;
-        //delete[] cmd_table;
-        //delete[] fis;
+        for (auto table : cmd_tables)
+            cmd_table_pool().free(table);
+        cmd_list_pool().free(cmd_head);
+        fis_pool().free(fis);
     }
 
     explicit operator bool() const
@@ -339,7 +346,7 @@ public:
         head->write      = write;
         head->prefetch   = true;
         head->clear_r_ok = true;
-        auto table = cmd_table + slot;
+        auto table = cmd_tables[slot];
 
         constexpr size_t SECTOR_SIZE = 512;
         constexpr size_t MAX_SECTORS = prdt_entry::MAX_SIZE / SECTOR_SIZE;
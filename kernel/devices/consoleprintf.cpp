@@ -13,9 +13,15 @@
 
 namespace console
 {
-static int num_printed;
 static char buffer[1024];
-static char* cur_loc = buffer;
+
+/* per-call formatter state, so snprintf never touches the screen buffer */
+struct out_state {
+    int   num_printed;
+    char* loc;        /* next output location */
+    char* end;        /* end of the snprintf output, or nullptr when
+                         printing to the screen through buffer */
+};
 
 static inline bool isdigit(char c)
 {
@@ -23,13 +29,18 @@ static inline bool isdigit(char c)
 }
 
 // put with count
-static inline void put_n(char c)
+static inline void put_n(out_state& st, char c)
 {
-    if (cur_loc > buffer+1022) {
-        puts(buffer);
-        cur_loc = buffer;
-    } else *cur_loc++ = c;
-    num_printed++;
+    if (st.end) {
+        if (st.loc < st.end) *st.loc++ = c;
+    } else {
+        if (st.loc > buffer+1022) {
+            puts(buffer);
+            st.loc = buffer;
+        }
+        *st.loc++ = c;
+    }
+    st.num_printed++;
 }
 
 static inline int skip_atoi(const char **s)
@@ -49,7 +60,7 @@ static inline int skip_atoi(const char **s)
 #define SPECIAL 32        /* 0x */
 #define SMALL   64        /* use 'abcdef' instead of 'ABCDEF' */
 
-static void number(int num, int base, int size, int precision, int type)
+static void number(out_state& st, int num, int base, int size, int precision, int type)
 {
     if (base<2 || base>36)
         return;
@@ -84,29 +95,29 @@ static void number(int num, int base, int size, int precision, int type)
     size -= precision;
     if (!(type&(ZEROPAD+LEFT)))
         while(size-->0)
-            put_n(' ');
+            put_n(st, ' ');
     if (sign)
-        put_n(sign);
+        put_n(st, sign);
     if (type&SPECIAL) {
         if (base==8)
-            put_n('0');
+            put_n(st, '0');
         else if (base==16) {
-            put_n('0');
-            put_n(digits[33]);
+            put_n(st, '0');
+            put_n(st, digits[33]);
         }
         }
     if (!(type&LEFT))
         while(size-->0)
-            put_n(c);
+            put_n(st, c);
     while(i<precision--)
-        put_n('0');
+        put_n(st, '0');
     while(i-->0)
-        put_n(tmp[i]);
+        put_n(st, tmp[i]);
     while(size-->0)
-        put_n(' ');
+        put_n(st, ' ');
 }
 
-static int _vprintf(const char *fmt, va_list args)
+static int _vprintf(out_state& st, const char *fmt, va_list args)
 {
     int len;
     int i;
@@ -120,13 +131,15 @@ static int _vprintf(const char *fmt, va_list args)
                    number of chars for from string */
     //int qualifier;    /* 'h', 'l', or 'L' for integer fields */
 
-    num_printed = 0;
-    buffer[1023] = '\0';
-    cur_loc = buffer;
+    st.num_printed = 0;
+    if (!st.end) {
+        buffer[1023] = '\0';
+        st.loc = buffer;
+    }
 
     for (;*fmt ; ++fmt) {
         if (*fmt != '%') {
-            put_n(*fmt);
+            put_n(st, *fmt);
             continue;
         }
             
@@ -180,10 +193,10 @@ static int _vprintf(const char *fmt, va_list args)
         case 'c':
             if (!(flags & LEFT))
                 while (--field_width > 0)
-                    put_n(' ');
-            put_n((char) va_arg(args, int));
+                    put_n(st, ' ');
+            put_n(st, (char) va_arg(args, int));
             while (--field_width > 0)
-                put_n(' ');
+                put_n(st, ' ');
             break;
 
         case 's':
@@ -196,15 +209,15 @@ static int _vprintf(const char *fmt, va_list args)
 
             if (!(flags & LEFT))
                 while (len < field_width--)
-                    put_n(' ');
+                    put_n(st, ' ');
             for (i = 0; i < len; ++i)
-                put_n(*s++);
+                put_n(st, *s++);
             while (len < field_width--)
-                put_n(' ');
+                put_n(st, ' ');
             break;
 
         case 'o':
-            number(va_arg(args, unsigned long), 8,
+            number(st, va_arg(args, unsigned long), 8,
                 field_width, precision, flags);
             break;
 
@@ -213,52 +226,75 @@ static int _vprintf(const char *fmt, va_list args)
                 field_width = 8;
                 flags |= ZEROPAD;
             }
-            number((unsigned long) va_arg(args, void *), 16, field_width, precision, flags);
+            number(st, (unsigned long) va_arg(args, void *), 16, field_width, precision, flags);
             break;
 
         case 'x':
             flags |= SMALL;
         case 'X':
-            number(va_arg(args, unsigned long), 16, field_width, precision, flags);
+            number(st, va_arg(args, unsigned long), 16, field_width, precision, flags);
             break;
 
         case 'd':
         case 'i':
             flags |= SIGN;
         case 'u':
-            number(va_arg(args, unsigned long), 10,
+            number(st, va_arg(args, unsigned long), 10,
                 field_width, precision, flags);
             break;
 
         case 'n':
             ip = va_arg(args, int *);
-            *ip = num_printed;
+            *ip = st.num_printed;
             break;
 
         default:
             if (*fmt != '%')
-                put_n('%');
+                put_n(st, '%');
             if (*fmt)
-                put_n(*fmt);
+                put_n(st, *fmt);
             else
                 --fmt;
             break;
         }
     }
 
-    if (cur_loc != buffer) {
-        *cur_loc = '\0';
+    if (st.end) {
+        *st.loc = '\0';
+    } else if (st.loc != buffer) {
+        *st.loc = '\0';
         puts(buffer);
     }
 
-    return num_printed;
+    return st.num_printed;
 }
 
 int printf(const char* fmt, ...)
 {
     va_list args;
     va_start(args, fmt);
-    int res = _vprintf(fmt, args);
+    out_state st = { 0, buffer, nullptr };
+    int res = _vprintf(st, fmt, args);
+    va_end(args);
+    return res;
+}
+
+int vsnprintf(char* buf, size_t size, const char* fmt, va_list args)
+{
+    char dummy;
+    if (size == 0) {
+        buf  = &dummy;
+        size = 1;
+    }
+    out_state st = { 0, buf, buf + size - 1 };
+    return _vprintf(st, fmt, args);
+}
+
+int snprintf(char* buf, size_t size, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int res = vsnprintf(buf, size, fmt, args);
     va_end(args);
     return res;
 }
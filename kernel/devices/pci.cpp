@@ -156,7 +156,7 @@ void bus_t::dump() const
 }
 
 
-linked_list<bus_t> bus_t::busses;
+slab::linked_list<bus_t> bus_t::busses;
 
 void bus_t::add_bus(uint8_t bus)
 {
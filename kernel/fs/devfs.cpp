@@ -18,6 +18,7 @@
 #include <lib/string.h>
 #include <devices/keyboard.h>
 #include <console.h>
+#include <heap.h>
 #include <memory>
 #include <algorithm>
 
@@ -33,9 +34,11 @@ namespace devfs
 
 static auto devfs_sb = make_shared<superblock>();
 
+constexpr size_t KHEAPSTAT_SIZE = 8192; // maximum size of the kheapstat report
+
 void init()
 {
-    shared_ptr<inode> tty_ind(new inode);
+    shared_ptr<inode> tty_ind = slab::make_shared_ptr(new inode);
     tty_ind->ino   = 1;
     tty_ind->uid   = 0;
     tty_ind->gid   = 0;
@@ -74,7 +77,7 @@ void init()
                 }
             };
 
-            fp = shared_ptr<file>(new tty_file);
+            fp = slab::make_shared_ptr(new tty_file);
             fp->nd   = shared_from_this();
             fp->mode = S_IFCHR | 0600;
 
@@ -82,20 +85,66 @@ void init()
         }
     };
 
-    shared_ptr<inode> root_ind(new inode);
+    shared_ptr<inode> kheapstat_ind = slab::make_shared_ptr(new inode);
+    kheapstat_ind->ino   = 2;
+    kheapstat_ind->uid   = 0;
+    kheapstat_ind->gid   = 0;
+    kheapstat_ind->size  = 0;
+    kheapstat_ind->mode  = S_IFREG | 0444;
+    kheapstat_ind->dirty = false;
+
+    struct kheapstat_node : node
+    {
+        virtual int open(std::shared_ptr<file>& fp)
+        {
+            // the report is generated once per open, so that reads see a consistent snapshot
+            struct kheapstat_file : file
+            {
+                unique_ptr<char[]> text;
+                size_t             len = 0;
+
+                virtual ssize_t read(void* buf, size_t count)
+                {
+                    if (position >= off_t(len))
+                        return 0;
+                    count = min(count, len - size_t(position));
+                    memcpy(buf, text.get() + position, count);
+                    position += count;
+                    return count;
+                }
+            };
+
+            auto f = new kheapstat_file;
+            f->text.reset(new char[KHEAPSTAT_SIZE]);
+            f->len = heap::print_stats(f->text.get(), KHEAPSTAT_SIZE);
+
+            fp = slab::make_shared_ptr(f);
+            fp->nd   = shared_from_this();
+            fp->mode = S_IFREG | 0444;
+
+            return 0;
+        }
+    };
+
+    shared_ptr<inode> root_ind = slab::make_shared_ptr(new inode);
     root_ind->ino = 0;
     root_ind->uid = root_ind->gid = 0;
     root_ind->size = 0;
     root_ind->mode = S_IFDIR | 0777;
 
-    shared_ptr<node> root_nd(new node);
+    shared_ptr<node> root_nd = slab::make_shared_ptr(new node);
 
-    shared_ptr<node> tty_nd(new tty_node);
+    shared_ptr<node> tty_nd = slab::make_shared_ptr(new tty_node);
     tty_nd->ind = tty_ind;
     strcpy(tty_nd->name, "tty");
 
+    shared_ptr<node> kheapstat_nd = slab::make_shared_ptr(new kheapstat_node);
+    kheapstat_nd->ind = kheapstat_ind;
+    strcpy(kheapstat_nd->name, "kheapstat");
+
     root_nd->ind = root_ind;
     root_nd->add_child(tty_nd);
+    root_nd->add_child(kheapstat_nd);
     strcpy(root_nd->name, "dev");
 
     root_ind->ino   = 0;
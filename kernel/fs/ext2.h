@@ -19,7 +19,7 @@
 #include <sys/types.h>
 #include <lib/spinlock.h>
 #include <lib/mutex.h>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 #include <memory>
 
 namespace fs
@@ -615,7 +615,7 @@ struct inode_info : fs::inode {
      * reserve_window_node.
      */
     mutex truncate_mutex;
-    linked_list<ino_t> i_orphan;	/* unlinked but open inodes */
+    slab::linked_list<ino_t> i_orphan;	/* unlinked but open inodes */
 #ifdef CONFIG_QUOTA
     struct dquot *i_dquot[MAXQUOTAS];
 #endif
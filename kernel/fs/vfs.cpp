@@ -15,6 +15,7 @@
    along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <fs.h>
+#include <scratch.h>
 #include <lib/string.h>
 #include <devices/keyboard.h>
 #include <console.h>
@@ -22,7 +23,6 @@
 #include <algorithm>
 
 using std::shared_ptr;
-using std::unique_ptr;
 using std::min;
 
 namespace fs
@@ -34,7 +34,10 @@ shared_ptr<node> node::walk(const char* path)
 {
     if (!path)
         return nullptr;
-    unique_ptr<char[]> buf(new char[MAX_NAME_LEN + 1]);
+    scratch::scope sc;
+    const auto buf = sc.alloc_array<char>(MAX_NAME_LEN + 1);
+    if (unlikely(!buf))
+        return nullptr;
     auto nd = shared_from_this();
     while (*path && nd) {
         if (*path == '/')
@@ -45,12 +48,12 @@ shared_ptr<node> node::walk(const char* path)
         if (i >= MAX_NAME_LEN && *path && *path != '/')
             return nullptr;
         buf[i] = '\0';
-        if (i == 0 || !strcmp(buf.get(), "."))
+        if (i == 0 || !strcmp(buf, "."))
             continue;
-        else if (!strcmp(buf.get(), ".."))
+        else if (!strcmp(buf, ".."))
             nd = nd->parent.lock();
         else
-            nd = nd->get(buf.get());
+            nd = nd->get(buf);
         if (!nd)
             return nullptr;
     }
@@ -82,8 +85,8 @@ void init()
     superblock::root_sb.type.name = "vfs_root";
     superblock::root_sb.mode = S_IFDIR | 0777;
 
-    superblock::root_sb.root = shared_ptr<node>(new node);
-    superblock::root_sb.root->ind = shared_ptr<inode>(new inode);
+    superblock::root_sb.root = slab::make_shared_ptr(new node);
+    superblock::root_sb.root->ind = slab::make_shared_ptr(new inode);
     superblock::root_sb.root->ind->ino = 0;
     superblock::root_sb.root->ind->uid = 0;
     superblock::root_sb.root->ind->gid = 0;
@@ -92,8 +95,8 @@ void init()
     strcpy(superblock::root_sb.root->name, "root");
 
     // Setup empty /dev node
-    shared_ptr<node> devfs_node(new node);
-    devfs_node->ind = shared_ptr<inode>(new inode);
+    shared_ptr<node> devfs_node = slab::make_shared_ptr(new node);
+    devfs_node->ind = slab::make_shared_ptr(new inode);
     devfs_node->ind->ino = 1;
     devfs_node->ind->uid = 0;
     devfs_node->ind->gid = 0;
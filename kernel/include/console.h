@@ -17,6 +17,9 @@
 #ifndef _CONSOLE_H_
 #define _CONSOLE_H_
 
+#include <stddef.h>
+#include <stdarg.h>
+
 namespace console
 {
 
@@ -28,6 +31,11 @@ void puts(const char* s);
 
 int  printf(const char* fmt, ...);
 
+// print to buf, writing at most size bytes including the terminating '\0';
+// returns the length of the whole output
+int  snprintf(char* buf, size_t size, const char* fmt, ...);
+int  vsnprintf(char* buf, size_t size, const char* fmt, va_list args);
+
 // clears the screen
 void clear();
 
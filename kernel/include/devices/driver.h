@@ -18,7 +18,7 @@
 #define _DRIVER_H_
 
 #include <stdint.h>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 
 namespace devices
 {
@@ -35,7 +35,7 @@ public:
 
 class block_driver : public driver
 {
-    static linked_list<block_driver> drivers;
+    static slab::linked_list<block_driver> drivers;
 protected:
     static void register_drv(block_driver& drv);
 public:
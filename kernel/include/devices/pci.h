@@ -19,7 +19,7 @@
 
 #include <stdint.h>
 #include <lib/vector.h>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 #include <memory>
 #include <functional>
 
@@ -217,7 +217,7 @@ class bus_t
     friend void init();
     friend class device_t;
 
-    static linked_list<bus_t> busses;
+    static slab::linked_list<bus_t> busses;
 
     static void add_bus(uint8_t bus);
 
@@ -233,7 +233,7 @@ public:
 
     void dump() const;
 
-    static linked_list<bus_t>& get_busses() { return busses; }
+    static slab::linked_list<bus_t>& get_busses() { return busses; }
     static void dump_all();
 };
 
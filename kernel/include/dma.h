@@ -0,0 +1,93 @@
+/* DMA buffer allocator header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _DMA_H_
+#define _DMA_H_
+
+/* Physically contiguous buffers for devices */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <paging.h>
+
+namespace dma
+{
+
+/* buffers come from the kernel identity map, which is write-back cached
+   memory that x86 keeps coherent with bus masters, so the CPU and the device
+   see the same data without remapping; the bus address is the physical one */
+typedef uint32_t bus_addr_t;
+
+/* sz bytes of zeroed, physically contiguous memory from a buddy block of
+   the smallest order that fits (so it is aligned to that size); flags is
+   FRAME_KERNEL or FRAME_DMA (below 16MiB) */
+void* alloc_coherent(size_t sz, bus_addr_t* bus_addr, uint32_t flags = paging::FRAME_KERNEL);
+void free_coherent(void* vaddr, size_t sz);
+
+/* fixed size objects for descriptors, carved from buddy blocks: every object
+   is aligned to align, and no object crosses a multiple of boundary (if it is
+   not 0); both have to be powers of two */
+class pool
+{
+public:
+    /* the name must outlive the pool */
+    pool(const char* name, size_t size, size_t align, size_t boundary = 0,
+         uint32_t flags = paging::FRAME_KERNEL);
+    ~pool();
+
+    pool(const pool&) = delete;
+    pool& operator=(const pool&) = delete;
+
+    // a zeroed object, or nullptr if there is no memory
+    void* alloc(bus_addr_t* bus_addr);
+    void free(void* vaddr);
+
+    friend void dump_stats();
+
+private:
+    struct chunk
+    {
+        chunk*   next;
+        void*    vaddr;         /* start of the buddy block */
+        void*    free_list;     /* singly linked list of free objects */
+        uint32_t inuse;
+    };
+
+    const char* name;
+    size_t      size;           /* object size */
+    size_t      stride;         /* distance between two objects */
+    size_t      boundary;
+    uint32_t    flags;          /* frame allocation flags */
+    uint8_t     order;          /* order of the chunks */
+
+    chunk*      chunks = nullptr;
+
+    /* statistics */
+    uint32_t num_chunks = 0;
+    uint32_t num_active = 0;
+    uint32_t num_allocs = 0;
+
+    pool* next_pool;            /* list of all pools */
+
+    chunk* grow();
+    chunk* find_chunk(const void* vaddr) const;
+};
+
+void dump_stats();
+
+}
+
+#endif /* _DMA_H_ */
@@ -24,8 +24,9 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <errno.h>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 #include <lib/userptr.h>
+#include <slab.h>
 #include <atomic>
 #include <memory>
 #include <dirent.h>
@@ -46,8 +47,10 @@ struct superblock;
 struct node;
 struct file;
 
-struct inode : std::enable_shared_from_this<inode>
+struct inode : std::enable_shared_from_this<inode>, slab::cached<inode>
 {
+    static const char* slab_name() { return "fs_inode"; }
+
     ino_t  ino;
     uid_t  uid;
     gid_t  gid;
@@ -67,17 +70,19 @@ struct inode : std::enable_shared_from_this<inode>
     }
 };
 
-struct node : std::enable_shared_from_this<node>
+struct node : std::enable_shared_from_this<node>, slab::cached<node>
 {
+    static const char* slab_name() { return "fs_node"; }
+
     std::shared_ptr<inode> ind; // corresponding inode
     std::weak_ptr<node>    parent;
     char                   name[MAX_NAME_LEN];
 
     // list of bind points
-    linked_list<std::shared_ptr<superblock>> bind_points;
+    slab::linked_list<std::shared_ptr<superblock>> bind_points;
 
     // list of children (of a directory)
-    linked_list<std::shared_ptr<node>> children;
+    slab::linked_list<std::shared_ptr<node>> children;
 
     virtual ~node()
     {
@@ -155,8 +160,10 @@ struct superblock
 
 
 // an opened file
-struct file
+struct file : slab::cached<file>
 {
+    static const char* slab_name() { return "fs_file"; }
+
     std::shared_ptr<node> nd;   // corresponding node
     uint32_t              oflags;
     mode_t                mode;
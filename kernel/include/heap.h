@@ -47,6 +47,8 @@ struct boundary_header
     boundary_header* next;
 
     bool used;                  /* is the block used? */
+    uint8_t site;               /* index of the allocating call site in the site table */
+    bool decommitted;           /* free block whose interior pages were released by reclaim() */
 
     /* insert x after the current header */
     void insert(boundary_header* x)
@@ -73,11 +75,62 @@ struct boundary_footer
     boundary_header* header;    /* pointer to the current header */
 };
 
+constexpr uint32_t FL_COUNT  = 32;  // number of size classes (log2 of the block size)
+constexpr uint32_t MAX_SITES = 64;  // number of tracked call sites (site 0 collects the rest)
+
+struct heap_stats
+{
+    uint32_t heap_size;         /* bytes between HEAP_BASE and the end of the heap */
+    uint32_t bytes_used;        /* bytes in used blocks, including boundary tags */
+    uint32_t bytes_peak;        /* maximum of bytes_used */
+    uint32_t bytes_free;        /* bytes in free blocks */
+    uint32_t largest_free;      /* size of the largest free block */
+    uint32_t num_allocs;
+    uint32_t num_frees;
+    uint32_t num_sbrk;
+    uint32_t num_srel;
+    uint32_t num_reallocs;
+    uint32_t num_inplace;       /* reallocs that did not move the block */
+    uint32_t num_reclaims;      /* reclaim passes */
+    uint32_t pages_decommitted; /* pages released from free blocks by reclaim() (total) */
+    uint32_t pages_recommitted; /* released pages mapped again on reuse (total) */
+    uint32_t pages_released;    /* heap pages currently not backed by frames */
+
+    /* free blocks by size class: class i holds blocks of size [2**i, 2**(i+1)) */
+    uint32_t free_count[FL_COUNT];
+    uint32_t free_bytes[FL_COUNT];
+};
+
+struct heap_site
+{
+    const void* caller;         /* return address of the allocation */
+    uint32_t    allocs;         /* number of allocations */
+    uint32_t    live;           /* bytes currently allocated */
+    uint32_t    peak;           /* maximum of live */
+};
+
 bool is_online();
-void* alloc(uint32_t size, bool align);
+void* alloc(uint32_t size, bool align, const void* caller = nullptr);
 void free(void* p);
+// resize the block at p, in place if possible (alignment is not kept if the block moves)
+void* realloc(void* p, uint32_t size, const void* caller = nullptr);
 void init();
 
+// release the interior pages of large free blocks to the frame allocator
+// (they are mapped again when the block is reused)
+void reclaim();
+
+// map the pages of addr that were released by reclaim(); returns false if
+// addr is not in the heap (called from the page fault handler)
+bool handle_fault(void* addr);
+
+
+void get_stats(heap_stats& st);
+const heap_site* get_sites(); // MAX_SITES entries
+
+// write a text report of the heap statistics to buf, returning its length
+size_t print_stats(char* buf, size_t size);
+
 }
 
 #endif /* _HEAP_H_ */
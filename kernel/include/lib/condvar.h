@@ -20,7 +20,7 @@
 #include <proc.h>
 #include <errno.h>
 #include <atomic>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 #include <lib/spinlock.h>
 
 namespace process
@@ -38,7 +38,7 @@ public:
     int wake(tid_t tid=-1);
 
 private:
-    linked_list<process::proc_ptr> waiting_procs;
+    slab::linked_list<process::proc_ptr> waiting_procs;
 };
 
 }
@@ -88,6 +88,12 @@ inline void wait_for_interrupt()
     asm volatile ("sti; hlt; cli" ::: "memory");
 }
 
+// let pending interrupts in without waiting for one
+inline void poll_interrupts()
+{
+    asm volatile ("sti; nop; cli" ::: "memory");
+}
+
 inline void wrmsr(uint32_t msr, uint32_t low, uint32_t high=0)
 {
     asm volatile ("wrmsr" :: "c"(msr), "a"(low), "d"(high) : "memory");
@@ -0,0 +1,53 @@
+/* Containers with slab allocated nodes.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SLAB_CONTAINERS_H_
+#define _SLAB_CONTAINERS_H_
+
+#include <slab.h>
+#include <lib/rbtree.h>
+#include <lib/interval_tree.h>
+#include <lib/linked_list.h>
+
+namespace slab
+{
+
+struct rbtree_node_name
+{
+    static const char* slab_name() { return "rbtree_node"; }
+};
+
+struct list_node_name
+{
+    static const char* slab_name() { return "list_node"; }
+};
+
+template <class Node> using rbtree_node = cached<Node, rbtree_node_name>;
+template <class Node> using list_node   = cached<Node, list_node_name>;
+
+/* the containers of include/lib, with nodes taken from a cache per node type */
+template <typename T, typename Traits = rbtree_traits<T>>
+using rbtree = ::rbtree<T, Traits, rbtree_node>;
+
+template <typename T>
+using interval_tree = ::interval_tree<T, rbtree_node>;
+
+template <class T>
+using linked_list = ::linked_list<T, list_node>;
+
+}
+
+#endif /* _SLAB_CONTAINERS_H_ */
@@ -33,8 +33,12 @@ private:
     {
         auto dir = paging::get_current_dir();
         ASSERTH(dir != nullptr);
-        auto pg = dir->get_page((void*)ptr);
-        return pg && pg->present && pg->user && (!write || pg->rw);
+        auto pg = dir->lookup(ptr);
+        if (!pg.present && paging::fault_in(ptr, write))
+            pg = dir->lookup(ptr);
+        // copy-on-write pages are writable; the kernel faults on them like user code
+        return pg.present && pg.user &&
+               (!write || pg.rw || (pg.value & paging::PAGE_COW));
     }
 
 public:
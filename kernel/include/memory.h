@@ -40,26 +40,38 @@ inline uint32_t align_addr_4m(uint32_t addr)
 
 void* get_placement_addr();
 
-void init(uint32_t mem_sz);
+// mbd is the multiboot info (for the memory map)
+void init(const multiboot_info* mbd);
 
 constexpr uint32_t KMALLOC_ALIGN = 1;
 constexpr uint32_t KMALLOC_ZERO = 1<<1;
+// take the block from the reserved pools (see pool.h); safe in interrupt
+// handlers, but may fail, and can't be combined with KMALLOC_ALIGN
+constexpr uint32_t KMALLOC_ATOMIC = 1<<2;
 
-void* kmalloc(size_t sz, uint32_t flags=0, void** phys_addr=nullptr);
+// caller is the call site recorded in the heap statistics (defaults to the caller of kmalloc)
+void* kmalloc(size_t sz, uint32_t flags=0, void** phys_addr=nullptr, const void* caller=nullptr);
 
 void kfree(void* p);
 
-// remap [phys_addr, phys_addr + sz) to some VA
+// resize a block allocated with kmalloc (without KMALLOC_ALIGN), in place if possible
+void* krealloc(void* p, size_t sz);
+
+// remap [phys_addr, phys_addr + sz) to some VA (see vmalloc::ioremap, undo with vmalloc::iounmap)
 void* remap(const void* phys_addr, size_t sz, bool cache=false);
 
-/* system call */
+/* system calls */
 void* brk(void* addr);
+void* mmap(void* addr, size_t len, int prot, int flags); // anonymous private mappings only
+int munmap(void* addr, size_t len);
+int mprotect(void* addr, size_t len, int prot);
 
 }
 
 extern "C"
 {
 void* malloc(size_t sz);
+void* realloc(void* p, size_t sz);
 void free(void* p);
 }
 
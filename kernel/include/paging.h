@@ -19,16 +19,29 @@
 
 #include <memory.h>
 #include <lib/string.h>
-#include <lib/bitmap.h>
 #include <lib/klib.h>
 #include <console.h>
+#include <vma.h>
 #include <stdint.h>
 #include <sys/sched.h>
 #include <memory>
 
+/* with CONFIG_PAE, entries are 64 bits wide and frames above 4 GiB are used
+   for user pages; everything in the kernel identity map looks the same as
+   without it. the build doesn't offer it until it has booted under qemu
+   (-m 6G, the memory tests of kmain passing and ZONE_PAE frames reaching
+   user space); define CONFIG_PAE for both g++ and yasm to try it */
+
 namespace paging
 {
 
+#ifdef CONFIG_PAE
+typedef uint64_t pte_t;         /* a page table or directory entry */
+#else
+typedef uint32_t pte_t;
+#endif
+typedef uint32_t pfn_t;         /* physical address >> PAGE_SHIFT; 0 is never a usable frame */
+
 constexpr uint32_t PAGE_PRESENT      = 1;
 constexpr uint32_t PAGE_RW           = 2;
 constexpr uint32_t PAGE_US           = 4;
@@ -37,27 +50,164 @@ constexpr uint32_t PAGE_NOCACHE      = 16;
 constexpr uint32_t PAGE_ACCESSED     = 32;
 constexpr uint32_t PAGE_DIRTY        = 64;
 constexpr uint32_t PAGE_GLOBAL       = 256;
+constexpr uint32_t PAGE_COW          = 512;  /* first avail bit: read-only until the next write fault */
+#ifdef CONFIG_PAE
+constexpr pte_t    PAGE_NX           = pte_t(1) << 63; /* no execute (if the CPU has it, see nx_flag) */
+#else
+constexpr pte_t    PAGE_NX           = 0;
+#endif
 
 constexpr int PAGE_SHIFT      = 12;
 constexpr size_t PAGE_SIZE    = 1 << PAGE_SHIFT;
+#ifdef CONFIG_PAE
+constexpr int PAGE_TABLE_IN_PAGES_SHIFT = 9;
+#else
 constexpr int PAGE_TABLE_IN_PAGES_SHIFT = 10;
+#endif
 constexpr int PAGE_TABLE_SHIFT = PAGE_SHIFT + PAGE_TABLE_IN_PAGES_SHIFT;
 
-constexpr uint32_t PAGE_DIR_4M = 128;
+constexpr uint32_t PAGE_TABLE_ENTRIES = 1 << PAGE_TABLE_IN_PAGES_SHIFT;
+/* with PAE, the four page directories of the PDPT are kept back to back,
+   so that they can be indexed like one directory */
+constexpr uint32_t PAGE_DIR_ENTRIES   = 1 << (32 - PAGE_TABLE_SHIFT);
+
+constexpr uint32_t PAGE_DIR_4M = 128;  /* PS: a 4 MiB (2 MiB with PAE) page */
 
 constexpr uint8_t BUDDY_MAX_ORDER = 10;
 
+/* user memory covering whole aligned chunks of a page table is mapped with
+   large pages (see page_dir::map_large), each backed by one buddy block */
+constexpr uint8_t LARGE_PAGE_ORDER = PAGE_TABLE_IN_PAGES_SHIFT;
+constexpr size_t  LARGE_PAGE_SIZE  = PAGE_SIZE << LARGE_PAGE_ORDER;
+
+static_assert(LARGE_PAGE_SIZE == 1 << PAGE_TABLE_SHIFT, "a large page replaces one page table");
+
 // KERNEL_VIRTUAL_BASE .. KERNAL_VIRTUAL_BASE + KERNEL_IDMAP_SIZE shall be
 // identically mapped to the first IDMAP_SIZE.
 constexpr size_t KERNEL_IDMAP_SIZE = 0x10000000;
 
-// kernel stack location for each process
-constexpr size_t KERNEL_STACK_TOP  = memory::REMAP_END;
-constexpr size_t KERNEL_STACK_SIZE = 8192;
-constexpr size_t KERNEL_STACK_BOT  = KERNEL_STACK_TOP - KERNEL_STACK_SIZE;
+// every thread has its own kernel stack block in the kernel identity map,
+// with the scratch arena (see scratch.h) in the first page and the stack above it
+constexpr uint8_t KERNEL_STACK_ORDER = 2;
+constexpr size_t  KERNEL_STACK_BLOCK = PAGE_SIZE << KERNEL_STACK_ORDER;
+constexpr size_t  KERNEL_STACK_SIZE  = KERNEL_STACK_BLOCK - PAGE_SIZE;
+
+constexpr uint32_t KERNEL_IDMAP_FRAMES = KERNEL_IDMAP_SIZE >> PAGE_SHIFT;
+
+/* physical memory is split into zones; a zone never shares a buddy block
+   with another one, since the boundaries are 4MiB aligned */
+enum zone_type
+{
+    ZONE_DMA,                   /* below 16MiB, for legacy (ISA) DMA */
+    ZONE_NORMAL,                /* the rest of the kernel identity map */
+    ZONE_HIGHMEM,               /* not directly addressable by the kernel */
+    ZONE_PAE,                   /* above 4GiB; only for user pages (empty without CONFIG_PAE) */
+    NUM_ZONES
+};
+
+constexpr size_t ZONE_DMA_END = 0x1000000;
+constexpr pfn_t  ZONE_PAE_START = pfn_t(1) << (32 - PAGE_SHIFT);
+
+/* frame allocation flags; without FRAME_KERNEL or FRAME_DMA frames come
+   from highmem first, which is what user pages want */
+constexpr uint32_t FRAME_KERNEL = 1;    /* must be in the kernel identity map */
+constexpr uint32_t FRAME_DMA    = 1<<1; /* must be in ZONE_DMA */
+constexpr uint32_t FRAME_ATOMIC = 1<<2; /* may dip below the min watermark */
+constexpr uint32_t FRAME_ZERO   = 1<<3; /* zero the frames (order 0 requests are served from
+                                           the pools of frames zeroed while idle) */
+constexpr uint32_t FRAME_USER   = 1<<4; /* for user pages: may be above 4GiB (alloc_pfn only) */
+
+/* the frame allocator works on frame numbers; frames that may be above
+   4GiB (FRAME_USER) can only be handled this way */
+pfn_t alloc_pfn(uint8_t order = 0, uint32_t flags = FRAME_USER); /* 0 if there is no free block */
+uint32_t free_pfn(pfn_t pfn);        /* returns the number of frames freed (shared frames only lose a reference) */
+void share_pfn(pfn_t pfn);           /* add a reference to an order 0 frame */
+void split_frames(pfn_t pfn);        /* turn an allocated block into order 0 frames that are freed one by one */
+
+/* allocate continuous physical pages of size 2**order below 4GiB, return the physical address */
+inline void* alloc_frames(uint8_t order = 0, uint32_t flags = 0)
+{
+    return (void*) (alloc_pfn(order, flags & ~FRAME_USER) << PAGE_SHIFT);
+}
+/* same as above, but only from the kernel identity map */
+inline void* alloc_kernel_frames(uint8_t order = 0)
+{
+    return alloc_frames(order, FRAME_KERNEL);
+}
+/* free block at physical address p, returning the number of frames freed */
+inline uint32_t free_frames(void* p)
+{
+    return free_pfn(uint32_t(p) >> PAGE_SHIFT);
+}
+
+/* map the page containing the user address addr if it is in a vma of the
+   current process that allows the access; returns false if there is nothing to map */
+bool fault_in(const void* addr, bool write);
+
+/* zero one frame for the zeroed frame pools; returns false if there is
+   nothing to do. called from the idle loop */
+bool prezero_frame();
+
+union page;
+
+/* record that pg is the only mapping of the user frame pfn, so that
+   compaction may move the frame and update pg */
+void set_movable(pfn_t pfn, page* pg);
+
+/* move user frames out of the way to make a free block of the given order;
+   returns false if no block could be freed. alloc_pfn calls it when a
+   higher order allocation fails */
+bool compact(uint8_t order, uint32_t flags = 0);
+
+/* compact one block of LARGE_PAGE_ORDER if free memory is fragmented;
+   returns false if there is nothing to do. called from the idle loop */
+bool compact_idle();
+
+/* page coloring: frames whose numbers are equal modulo the number of colors
+   use the same sets of the (physically indexed) L2 cache. with coloring on,
+   every address space gets its user frames in round-robin color order, so
+   that its pages spread evenly over the cache. the colors are kept in lists
+   of order 0 frames, refilled with blocks that have one frame of each color.
+   make COLOR=1 turns it on at boot */
+constexpr uint32_t MAX_COLORS = 64;
+
+void set_page_coloring(bool on);
+bool page_coloring();
+uint32_t num_page_colors();         /* from the L2 size and associativity */
+uint32_t first_color();             /* the color a new address space starts at */
+
+/* an order 0 frame of the given color (modulo the number of colors) with
+   FRAME_KERNEL or FRAME_USER, or any frame if coloring is off or no frame of
+   that color is left; 0 if there is no memory */
+pfn_t alloc_colored_pfn(uint32_t color, uint32_t flags = FRAME_USER);
+
+/* temporary kernel mappings of frames: frames in the identity map are not
+   remapped at all, the others get one of the KMAP_SLOTS pages at the top of
+   the address space. use with interrupts disabled, and kunmap in the
+   reverse order of kmap */
+constexpr uint32_t KMAP_BASE  = memory::REMAP_END;
+constexpr int      KMAP_SLOTS = 4;
+
+void* kmap(pfn_t pfn);
+void  kunmap(const void* vaddr);
+
+void copy_frame(pfn_t dst, pfn_t src);
+void zero_frame(pfn_t pfn);
+
+/* PAGE_NX for memory without PROT_EXEC if the CPU supports it, 0 otherwise */
+pte_t nx_flag(uint32_t prot);
+
+// convert between physical addresses and the kernel identity map
+// (only valid for addresses below KERNEL_IDMAP_SIZE)
+inline void* phys_to_virt(const void* phys)
+{
+    return (void*) (uintptr_t(phys) + KERNEL_VIRTUAL_BASE);
+}
 
-void* alloc_frames(uint8_t order = 0); /* allocate continuous physical pages of size 2**order */
-uint32_t free_frames(void* p);       /* free block at physical address p, returning number of bytes freed */
+inline void* virt_to_phys(const void* virt)
+{
+    return (void*) (uintptr_t(virt) - KERNEL_VIRTUAL_BASE);
+}
 
 union page
 {
@@ -73,10 +223,16 @@ union page
         bool zero          : 1;      /* must be 0 */
         bool global        : 1;      /* if set, prevents TLB from updating the address in it's cache */
         unsigned int avail : 3;      /* unused bits */
+#ifdef CONFIG_PAE
+        pte_t addr         : 40;     /* page address >> 12 */
+        pte_t reserved     : 11;
+        bool nx            : 1;      /* no execute */
+#else
         unsigned int addr  : 20;     /* page address >> 12 */
+#endif
     };
 
-    uint32_t value;
+    pte_t value;
 };
 
 
@@ -94,30 +250,104 @@ union page_dir_entry
         bool ps            : 1;      /* 1 for 4MiB pages, 0 for 4KiB page tables */
         bool ignored       : 1;      /* ignored */
         unsigned int avail : 3;      /* unused bits */
+#ifdef CONFIG_PAE
+        pte_t addr         : 40;     /* page table address >> 12 (if PS=1, the addr must be 2MiB aligned)  */
+        pte_t reserved     : 11;
+        bool nx            : 1;      /* no execute (large pages) */
+#else
         unsigned int addr  : 20;     /* page table address >> 12 (if PS=1, the addr must be 4MiB aligned)  */
+#endif
     };
 
-    uint32_t value;
+    pte_t value;
 };
 
+static_assert(sizeof(page) == sizeof(pte_t) && sizeof(page_dir_entry) == sizeof(pte_t), "bad entry layout");
+
 struct page_table
 {
-    page pages[1024];
+    page pages[PAGE_TABLE_ENTRIES];
 
-    page_table* clone(void** phys_addr = nullptr);
+    /* with cow, user pages are shared copy-on-write instead of copied */
+    page_table* clone(void** phys_addr = nullptr, bool cow = false);
     void free();
 
 } __attribute__((packed));
 
+struct page_table;
+struct page_dir;
+
+/* page tables and directories are whole frames in the kernel identity map */
+page_table* alloc_table(void** phys_addr = nullptr); // zeroed
+void free_table(page_table* table);
+void free_page_dir(page_dir* dir);
+
 struct shared_page_dir;
 struct page_dir
 {
-    page_dir_entry entries[1024];
-    page_table*    tables[1024];     /* virtual addresses of the tables */
-    page_dir*      phys_addr;        /* physical address of the directory */
+    page_dir_entry entries[PAGE_DIR_ENTRIES];
+    page_table*    tables[PAGE_DIR_ENTRIES];     /* virtual addresses of the tables */
+#ifdef CONFIG_PAE
+    pte_t          pdpt[4] __attribute__((aligned(32))); /* points to the four parts of entries */
+
+    void init_pdpt();
+#endif
+
+    /* physical address of the directory (directories are always in the kernel identity map) */
+    inline page_dir* phys_addr() const
+    {
+        return (page_dir*) virt_to_phys(this);
+    }
+
+    /* the value of CR3 that loads the directory */
+    inline uint32_t cr3() const
+    {
+#ifdef CONFIG_PAE
+        return uint32_t(virt_to_phys(pdpt));
+#else
+        return uint32_t(phys_addr());
+#endif
+    }
+
+    /* the directory in CR3 */
+    static inline page_dir* current_loaded()
+    {
+        uint32_t cr3;
+        asm volatile ("mov %0, cr3" : "=r"(cr3));
+#ifdef CONFIG_PAE
+        cr3 -= __builtin_offsetof(page_dir, pdpt);
+#endif
+        return (page_dir*) phys_to_virt((void*)cr3);
+    }
+
+    /* whether this is the directory in CR3; kernel-only contexts (idle, exit)
+       keep the last one loaded, so it can differ from get_current_dir() */
+    inline bool loaded() const
+    {
+        return current_loaded() == this;
+    }
+
+    /* index of the entry and of the page in its table for the virtual address vaddr */
+    static inline uint32_t dir_index(uint32_t vaddr)
+    {
+        return vaddr >> PAGE_TABLE_SHIFT;
+    }
+    static inline uint32_t table_index(uint32_t vaddr)
+    {
+        return (vaddr >> PAGE_SHIFT) & (PAGE_TABLE_ENTRIES - 1);
+    }
+
+    /* whether the user address vaddr is in a large page */
+    inline bool is_large(uint32_t vaddr) const
+    {
+        const uint32_t idx = dir_index(vaddr);
+        return vaddr < KERNEL_VIRTUAL_BASE && !tables[idx] &&
+               entries[idx].present && entries[idx].ps;
+    }
 
     /* get a page in the current directory */
     // addr = virtual_address >> 12
+    // (nullptr in 4 MiB user pages, unless make_table is set, which splits them)
     page* get_page(uint32_t addr, bool make_table=false,
                    uint16_t flags = PAGE_PRESENT|PAGE_RW); // flag is for page_dir_entry only
 
@@ -128,6 +358,18 @@ struct page_dir
     }
 
 
+    /* the mapping of the page containing addr, including pages in large
+       pages; the value is 0 if it is not mapped */
+    page lookup(const void* addr) const;
+
+    /* map a zeroed large page at the user address vaddr (LARGE_PAGE_SIZE aligned,
+       with nothing mapped in the chunk yet); returns false if there is no free
+       block that large, in which case the caller uses 4 KiB pages */
+    bool map_large(uint32_t vaddr, pte_t flags = PAGE_PRESENT|PAGE_RW|PAGE_US);
+
+    /* replace the large page containing vaddr by a page table mapping the same frames */
+    void split_large(uint32_t vaddr);
+
     /* map pages to physical address; start = virt_addr >> 12, sz = # of pages */
     bool map_pages(uint32_t start, const void* phys_addr, uint32_t sz,
                    bool make_table = false, uint16_t flags = PAGE_PRESENT|PAGE_RW);
@@ -141,7 +383,8 @@ struct page_dir
     }
 
     /* create pages with arbitrary frames; start_pg_ind = virt_addr >> 12, sz = # of pages
-       flags is used for both page and table creation
+       flags is used for both page and table creation; whole 4 MiB chunks of
+       user memory get 4 MiB pages if possible
      */
     bool alloc_pages(uint32_t start_pg_ind, uint32_t sz,
                      uint16_t flags = PAGE_PRESENT|PAGE_RW);
@@ -156,55 +399,69 @@ struct page_dir
        (they must be copied regardless CLONE_VM is set or not) */
     page_dir* clone(uint32_t flags = 0, int stack_table_bot = -1, int stack_table_top = -1); /* flags as in sys/sched.h */
 
-    void free_tables(const page_dir* shared_vm_dir); // free everything EXCEPT per-process kernel stack and identical pages in shared_vm_dir*
-
-    // we can't use the kernel stack while freeing the stack
-    inline void free_kstack_tables()
-    {
-        for (int i = int(uint32_t(KERNEL_STACK_BOT) >> 22); i <= int(uint32_t(KERNEL_STACK_TOP) >> 22); i++)
-            if (tables[i]) {
-                tables[i]->free();
-                delete tables[i];
-                entries[i].value = 0;
-                tables[i] = nullptr;
-            }
-    }
-
-    inline void free_page(void* addr)
-    {
-        auto pg = get_page(addr);
-        if (unlikely(!pg || !pg->present))
-            return;
-        free_frames((void*)(uint32_t(pg->addr) << PAGE_SHIFT));
-        pg->value = 0;
-    }
+    void free_tables(const page_dir* shared_vm_dir); // free everything EXCEPT identical pages in shared_vm_dir*
 
 } __attribute__((packed));
 
+#ifdef CONFIG_PAE
+constexpr uint8_t PAGE_DIR_ORDER = 3;
+#else
+constexpr uint8_t PAGE_DIR_ORDER = 1;
+#endif
+static_assert(sizeof(page_dir) <= PAGE_SIZE << PAGE_DIR_ORDER, "page_dir must fit in a block of PAGE_DIR_ORDER");
+
 struct shared_page_dir : std::enable_shared_from_this<shared_page_dir>
 {
     page_dir* dir;
-    /* the dir used when calling CLONE_VM */
+    /* the dir whose tables are linked by a CLONE_VM child with its own stack
+       (threads created with CLONE_THREAD share the whole shared_page_dir) */
     std::shared_ptr<shared_page_dir> cloned_dir;
 
-    ~shared_page_dir()
-    {
-        if (likely(dir)) {
-            // free everything except cloned_dir
-            dir->free_tables(cloned_dir ? cloned_dir->dir : nullptr);
-            free(dir);
-            dir = nullptr;
-        }
-    }
+    vma_tree vmas;              /* anonymous memory: brk, bss and mmap */
+
+    /* shared by the threads like the vmas, so that brk and mmap in one
+       thread are seen by the others */
+    void* brk_start = nullptr;  /* start of heap */
+    void* brk_end   = nullptr;  /* end of heap */
+    void* stack_bot = nullptr;  /* bottom of stack */
+
+    uint32_t next_color = first_color(); /* page coloring: color of the next user frame */
+
+    ~shared_page_dir();
 };
 
+/* the descriptor of a frame. the free lists of the buddy allocator are
+   threaded through the descriptors, and whether a block is free is kept in
+   its head, so merging only has to look at the buddy's descriptor */
 struct page_list_entry
 {
-    page_list_entry* prev;
+    union
+    {
+        page_list_entry* prev;  /* free blocks */
+        page* rmap;             /* movable frames: the only page mapping the frame */
+    };
     page_list_entry* next;
-    uint8_t order;
+    uint8_t order;              /* order of the block starting here; 0xff if unmanaged */
+    uint8_t flags;
+    uint16_t shared;            /* number of extra mappings of a copy-on-write frame */
+
+    enum : uint8_t
+    {
+        FREE       = 1<<0,      /* the head of a free block */
+        MOVABLE    = 1<<1,      /* an anonymous user page that compaction may move */
+        ZONE_SHIFT = 2          /* the zone_type is in the bits above */
+    };
 
-    page_list_entry() : order(0xff) {}
+    page_list_entry() : order(0xff), flags(0), shared(0) {}
+
+    bool is_free() const { return flags & FREE; }
+    bool is_movable() const { return flags & MOVABLE; }
+    zone_type zone() const { return zone_type(flags >> ZONE_SHIFT); }
+
+    void set_flag(uint8_t flag, bool on)
+    {
+        flags = on ? (flags | flag) : (flags & ~flag);
+    }
 
     /* insert x after the current entry */
     void insert(page_list_entry* x)
@@ -223,13 +480,34 @@ struct page_list_entry
     }
 };
 
+static_assert(sizeof(page_list_entry) == 12, "frame descriptors should stay small");
+
 struct page_list
 {
     page_list_entry nil;
-    bitmap* map;
     int num_avail;
 };
 
+struct zone
+{
+    const char* name;
+    uint32_t start, end;        /* frame index range [start, end) */
+    page_list lists[BUDDY_MAX_ORDER + 1];
+
+    uint32_t managed;           /* frames handed to the buddy allocator */
+    uint32_t free;              /* free frames */
+
+    /* allocations that do not prefer this zone leave at least wmark_low
+       frames; only FRAME_ATOMIC allocations go below wmark_min */
+    uint32_t wmark_min;
+    uint32_t wmark_low;
+
+    /* statistics */
+    uint32_t num_allocs;
+    uint32_t num_fallbacks;     /* allocations that preferred another zone */
+    uint32_t num_failures;
+};
+
 extern "C" page_dir kernel_page_dir;        /* defined in boot.s */
 
 void dump_paging_stats();
@@ -239,13 +517,79 @@ page_dir* get_current_dir();
 void set_page_dir(page_dir* dir); /* set cur_dir but don't flush tlb */
 void switch_page_dir(page_dir* dir);
 
+/* the kernel heap grows in 4 MiB pages where it can (see heap::sbrk). their
+   page tables are filled in as well, so a directory that still has the old
+   entry sees the same memory; it gets the new one from kernel_page_dir in
+   sync_kernel_entries(), which has to be called before the directory is loaded */
+void sync_kernel_entries(page_dir* dir);
+
+/* map a 4 MiB page at the heap address vaddr (4 MiB aligned, with nothing
+   mapped in the chunk yet); returns false if there is no free block that large */
+bool map_kernel_large(uint32_t vaddr);
+bool is_kernel_large(uint32_t vaddr); /* whether vaddr is in such a page */
+
 /* flush TLB entry for the page containing virtual address addr */
 inline void flush_tlb_entry(void* addr)
 {
     asm volatile ("invlpg [%0]" :: "r"(addr) : "memory");
 }
 
-void init(uint32_t mem_sz);
+/* flush the whole TLB except global pages */
+inline void flush_tlb()
+{
+    uint32_t cr3;
+    asm volatile ("mov %0, cr3" : "=r"(cr3));
+    asm volatile ("mov cr3, %0" :: "r"(cr3) : "memory");
+}
+
+/* flush the whole TLB including global pages (by toggling CR4.PGE) */
+inline void flush_tlb_global()
+{
+    uint32_t cr4;
+    asm volatile ("mov %0, cr4" : "=r"(cr4));
+    asm volatile ("mov cr4, %0" :: "r"(cr4 & ~(1<<7)) : "memory");
+    asm volatile ("mov cr4, %0" :: "r"(cr4) : "memory");
+}
+
+/* batches the teardown of mappings in dir: pages are cleared right away, but
+   the TLB is invalidated once per batch (invlpg for a few pages, a full flush
+   for many), and the frames are freed only after that, so that no stale TLB
+   entry can reach a frame that has been handed out again */
+class unmap_batch
+{
+public:
+    explicit unmap_batch(page_dir* dir) : dir(dir) {}
+    ~unmap_batch() { flush(); }
+
+    unmap_batch(const unmap_batch&) = delete;
+    unmap_batch& operator=(const unmap_batch&) = delete;
+
+    void unmap(uint32_t vaddr);                     /* clear the page and free its frame */
+    void unmap_range(uint32_t start, uint32_t end); /* ditto, skipping missing tables */
+    void invalidate(uint32_t vaddr);                /* only drop the TLB entry of a changed page */
+
+    void flush();
+
+private:
+    static constexpr int BATCH_SIZE = 64;
+    static constexpr int INVLPG_MAX = 16;   /* above this, a full flush is cheaper */
+
+    void add(uint32_t vaddr, pfn_t frame);
+
+    page_dir* dir;
+    int       count = 0;
+    uint32_t  vaddrs[BATCH_SIZE];
+    pfn_t     frames[BATCH_SIZE];           /* 0 for pages that were only changed */
+};
+
+/* a range of usable physical memory [start, end) from the memory map */
+struct phys_range
+{
+    pfn_t start, end;
+};
+
+/* frames is the number of frames up to the end of the highest range */
+void init(pfn_t frames, const phys_range* ranges, int num_ranges);
 }
 
 #endif  /* _PAGING_H_ */
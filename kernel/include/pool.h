@@ -0,0 +1,55 @@
+/* Atomic allocation pools header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/* Reserved objects for allocations in interrupt handlers */
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace pool
+{
+
+constexpr size_t MAX_SIZE = 2048; // largest atomic allocation
+
+// true if some pool dropped below its low watermark (or grew past its
+// high watermark); checked by kmalloc on the process context path
+extern volatile bool refill_pending;
+
+/* take an object of at least sz bytes; never blocks and never touches the
+   heap or the frame allocator, so it can be called with interrupts disabled
+   or from an interrupt handler. returns nullptr if the pool is exhausted */
+void* alloc(size_t sz);
+
+// check whether p is an object of one of the pools
+bool owns(const void* p);
+
+// return an object to its pool (safe in interrupt handlers)
+void free(void* p);
+
+/* bring every pool back between its watermarks; takes memory from the slab
+   allocator, so it must only be called from process context */
+void refill();
+
+void dump_stats();
+
+void init();
+
+}
+
+#endif /* _POOL_H_ */
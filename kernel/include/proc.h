@@ -27,6 +27,7 @@
 #include <lib/vector.h>
 #include <lib/bitmap.h>
 #include <lib/userptr.h>
+#include <slab.h>
 #include <functional>
 #include <atomic>
 #include <memory>
@@ -91,8 +92,17 @@ struct proc_state
     }
 } __attribute__((packed));
 
-struct proc
+// what syscall_entry (syscall/entry.s) leaves at the top of the kernel stack
+struct syscall_frame
 {
+    uint32_t edi, esi, edx, ecx;      // args
+    uint32_t user_esp, user_eip;
+} __attribute__((packed));
+
+struct proc : slab::cached<proc>
+{
+    static const char* slab_name() { return "proc"; }
+
     tid_t tid;
     pid_t pid;
     uid_t uid;
@@ -111,6 +121,21 @@ struct proc
 
     std::shared_ptr<paging::shared_page_dir> dir;
 
+    uint8_t* kstack = nullptr;  // kernel stack block (see paging::KERNEL_STACK_BLOCK)
+
+    inline uint32_t kstack_top() const
+    {
+        return uint32_t(kstack) + paging::KERNEL_STACK_BLOCK;
+    }
+
+    inline syscall_frame* get_syscall_frame() const
+    {
+        return (syscall_frame*) (kstack_top() - sizeof(syscall_frame));
+    }
+
+    bool alloc_kstack();
+    void free_kstack();
+
     union
     {
         struct
@@ -128,11 +153,6 @@ struct proc
     uint32_t clone_flags = 0;
     int      exit_status;       // status in exit(status);
 
-    void*    brk_start;         // start of heap
-    void*    brk_end;           // end of heap
-
-    void*    stack_bot;         // bottom of stack
-
     /* fs root */
     fs::superblock* root_sb = &fs::superblock::root_sb;
 
@@ -178,6 +198,7 @@ struct proc
     ~proc()
     {
         remove();
+        free_kstack();
     }
 
     enum
@@ -227,8 +248,8 @@ struct proc
     }
 
     proc() : tid(-1), pid(-1), dir(nullptr), signals(0) {}
-    proc(paging::shared_page_dir* dir) : dir(dir), signals(32) { tid = pid = next_tid++; }
-    proc(pid_t pid, paging::shared_page_dir* dir = nullptr) : tid(next_tid++), pid(pid), dir(dir), signals(32) {}
+    proc(paging::shared_page_dir* dir) : dir(slab::make_shared_ptr(dir)), signals(32) { tid = pid = next_tid++; }
+    proc(pid_t pid, paging::shared_page_dir* dir = nullptr) : tid(next_tid++), pid(pid), dir(slab::make_shared_ptr(dir)), signals(32) {}
 
     static tid_t next_tid;
 };
@@ -297,9 +318,11 @@ void init();
 int _kill_current(int sig);
 
 
+void dump_sched_stats();
+
 /* system calls */
 void exit(int status);
-int clone(uint32_t flags);
+int clone(uint32_t flags, void* child_stack); // child_stack is only used with CLONE_THREAD
 
 pid_t getpid();
 uid_t getuid();
@@ -308,6 +331,7 @@ int setnice(int inc, tid_t tid);
 int getnice(tid_t tid);
 
 int nanosleep(uint64_t ns);
+int sched_yield(); // run the other ready tasks first
 
 int tkill(tid_t tid, int sig);
 
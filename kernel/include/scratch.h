@@ -0,0 +1,80 @@
+/* Per-process scratch arena header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+/* Bump allocator for short-lived allocations in syscalls */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <paging.h>
+
+namespace scratch
+{
+
+// every thread has one page right below its kernel stack, at the beginning
+// of the kernel stack block (see paging::KERNEL_STACK_BLOCK)
+constexpr size_t SCRATCH_SIZE  = paging::PAGE_SIZE;
+constexpr size_t SCRATCH_START = 16; // offset of the first allocation (after the header)
+
+static_assert(paging::KERNEL_STACK_BLOCK == 0x4000 && SCRATCH_START == 16, "update syscall/entry.s");
+
+struct arena
+{
+    uint32_t used;              /* offset of the first free byte; reset on syscall return (see entry.s) */
+};
+
+// prepare the arena of a new kernel stack block
+inline void init_arena(void* kstack)
+{
+    ((arena*) kstack)->used = SCRATCH_START;
+}
+
+/* allocations are released when the scope that made them ends; scopes
+   have to be nested. requests that do not fit in the arena (or are made
+   outside of a process) fall back to kmalloc */
+class scope
+{
+public:
+    scope();
+    ~scope();
+
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    void* alloc(size_t sz, size_t align = sizeof(uintptr_t));
+
+    template <class T>
+    inline T* alloc_array(size_t n)
+    {
+        return (T*) alloc(n * sizeof(T), alignof(T));
+    }
+
+private:
+    struct fallback_block
+    {
+        fallback_block* next;
+    };
+
+    arena*          a;          /* nullptr if there is no arena */
+    uint32_t        saved;      /* arena offset at the beginning of the scope */
+    fallback_block* fallbacks = nullptr;
+};
+
+}
+
+#endif /* _SCRATCH_H_ */
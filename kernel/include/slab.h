@@ -0,0 +1,216 @@
+/* Kernel slab allocator header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+/* Object caches for fixed size kernel objects */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory.h>
+#include <memory>
+
+namespace slab
+{
+
+constexpr uint32_t SLAB_MAGIC = 0x42414C53; // "SLAB"
+
+class cache;
+
+/* every slab is a single page in the kernel identity map, with this header
+   at the beginning of the page followed by the objects */
+struct slab_header
+{
+    uint32_t magic;             /* slab magic */
+    cache*   owner;             /* the cache this slab belongs to */
+
+    /* linked list pointers */
+    slab_header* prev;
+    slab_header* next;
+
+    void*    free_list;         /* singly linked list of free objects */
+    uint32_t inuse;             /* number of allocated objects */
+
+    /* insert x after the current header */
+    void insert(slab_header* x)
+    {
+        next->prev = x;
+        x->prev = this;
+        x->next = next;
+        next = x;
+    }
+
+    /* remove the node from list */
+    void remove()
+    {
+        prev->next = next;
+        next->prev = prev;
+        prev = nullptr;
+        next = nullptr;
+    }
+
+    inline bool empty_list() const
+    {
+        return next == this;
+    }
+};
+
+class cache
+{
+public:
+    using ctor_t = void (*)(void*);
+
+    /* the name must outlive the cache; ctor is called once per object when a
+       new slab is created, and objects have to be returned in the constructed state */
+    cache(const char* name, size_t size, size_t align = sizeof(void*), ctor_t ctor = nullptr);
+
+    void* alloc();
+    void free(void* p);
+
+    void shrink(); // release the cached empty slab
+
+    inline const char* get_name() const { return name; }
+    inline size_t get_size() const { return size; }
+
+    friend void dump_stats();
+
+private:
+    const char* name;
+    size_t      size;           /* object size */
+    size_t      stride;         /* distance between two objects */
+    size_t      link_offset;    /* offset of the free list pointer in an object */
+    size_t      first_offset;   /* offset of the first object in the slab */
+    uint32_t    objs_per_slab;
+    ctor_t      ctor;
+
+    slab_header partial;        /* slabs with both free and allocated objects */
+    slab_header full;           /* slabs without free objects */
+    slab_header empty;          /* at most one slab without allocated objects */
+
+    /* statistics */
+    uint32_t num_slabs  = 0;
+    uint32_t num_active = 0;
+    uint32_t num_allocs = 0;
+
+    cache* next_cache;          /* list of all caches */
+
+    slab_header* grow();
+    void release(slab_header* s);
+};
+
+bool is_online();
+
+// check whether p is an object allocated from a slab
+bool owns(const void* p);
+
+// the cache p belongs to (p must be owned by a slab)
+cache* get_cache(const void* p);
+
+// size of the objects of the cache p belongs to (p must be owned by a slab)
+size_t object_size(const void* p);
+
+// free an object allocated from a slab (p must be owned by a slab; named
+// differently from ::free, since slab is an associated namespace of cached types)
+void free_object(void* p);
+
+void dump_stats();
+
+void init();
+
+/* inherit from cached<T> to allocate objects of type T from a per-type cache
+   (Name has to provide a static slab_name()); objects of derived types that
+   are larger than T fall back to kmalloc */
+template <class T, class Name = T>
+struct cached
+{
+    static cache& get_cache()
+    {
+        static cache c(Name::slab_name(), sizeof(T), alignof(T));
+        return c;
+    }
+
+    // noexcept, so that new returns nullptr instead of constructing into it
+    static void* operator new(size_t sz) noexcept
+    {
+        if (sz == sizeof(T))
+            return get_cache().alloc();
+        return memory::kmalloc(sz, 0, nullptr, __builtin_return_address(0));
+    }
+
+    static void operator delete(void* p)
+    {
+        memory::kfree(p);
+    }
+};
+
+// write "shared_ptr<Owner>" to buf, taking the type name from the
+// __PRETTY_FUNCTION__ of allocator<T, Owner>::get_cache()
+const char* ctl_cache_name(char* buf, const char* pretty);
+
+/* an allocator of single objects from a per-type cache, for the control
+   blocks of shared_ptrs (see make_shared_ptr); Owner is the type the
+   shared_ptr owns, and names the cache */
+template <class T, class Owner = T>
+struct allocator
+{
+    typedef T value_type;
+
+    template <class U> struct rebind { typedef allocator<U, Owner> other; };
+
+    allocator() = default;
+    template <class U> allocator(const allocator<U, Owner>&) {}
+
+    static cache& get_cache()
+    {
+        static char name[sizeof(__PRETTY_FUNCTION__)];
+        static cache c(ctl_cache_name(name, __PRETTY_FUNCTION__), sizeof(T), alignof(T));
+        return c;
+    }
+
+    T* allocate(size_t n)
+    {
+        if (n == 1)
+            return (T*) get_cache().alloc();
+        return (T*) memory::kmalloc(n * sizeof(T), 0, nullptr, __builtin_return_address(0));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        // not get_cache().free(p): before slab::init the cache hands out
+        // placement memory, which kfree knows to leave alone
+        memory::kfree(p);
+    }
+};
+
+template <class T, class U, class Owner>
+inline bool operator==(const allocator<T, Owner>&, const allocator<U, Owner>&) { return true; }
+template <class T, class U, class Owner>
+inline bool operator!=(const allocator<T, Owner>&, const allocator<U, Owner>&) { return false; }
+
+/* a shared_ptr owning p (or an empty one if p is nullptr), whose control
+   block comes from a cache instead of the heap */
+template <class T>
+inline std::shared_ptr<T> make_shared_ptr(T* p)
+{
+    if (!p)
+        return nullptr;
+    return std::shared_ptr<T>(p, std::default_delete<T>(), allocator<T>());
+}
+
+}
+
+#endif /* _SLAB_H_ */
@@ -24,6 +24,14 @@ namespace time
 
 void init();
 
+// read current CPU time-stamp counter
+inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo + (uint64_t(hi) << 32);
+}
+
 void nsleep(uint64_t ns);
 
 inline void usleep(uint64_t us)
@@ -0,0 +1,62 @@
+/* Virtual memory areas header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _VMA_H_
+#define _VMA_H_
+
+/* Ranges of anonymous user memory of an address space */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <lib/slab_containers.h>
+
+namespace paging
+{
+
+/* memory in a vma is only mapped when it is first touched (see fault_in) */
+struct vma
+{
+    uintptr_t start, end;       /* [start, end), page aligned */
+    uint32_t  prot;             /* PROT_* in sys/mman.h */
+};
+
+class vma_tree
+{
+public:
+    const vma* find(uintptr_t addr) const; // the vma containing addr
+
+    bool overlaps(uintptr_t start, uintptr_t end) const;
+    bool covers(uintptr_t start, uintptr_t end) const; // every page of [start, end) is in a vma
+
+    /* all of these take page aligned ranges, and merge neighbouring vmas
+       with the same protection; they return false, leaving the vmas as they
+       were, if we run out of memory */
+    bool map(uintptr_t start, uintptr_t end, uint32_t prot); // replaces what was mapped there before
+    bool unmap(uintptr_t start, uintptr_t end);
+    bool protect(uintptr_t start, uintptr_t end, uint32_t prot); // also false if [start, end) is not covered
+
+    // highest free range of len bytes in [low, high), or 0 if there is none
+    uintptr_t find_free(size_t len, uintptr_t low, uintptr_t high) const;
+
+    inline size_t size() const { return tree.size(); }
+
+private:
+    slab::interval_tree<vma> tree;
+};
+
+}
+
+#endif /* _VMA_H_ */
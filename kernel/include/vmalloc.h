@@ -0,0 +1,60 @@
+/* Kernel virtual address space allocator header.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+/* Virtually contiguous kernel mappings between the heap and the kmap slots */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <heap.h>
+#include <memory.h>
+
+namespace vmalloc
+{
+
+constexpr uintptr_t VMALLOC_START = heap::HEAP_END;
+constexpr uintptr_t VMALLOC_END   = memory::REMAP_END;
+
+/* every area is followed by an unmapped guard page, so that running off
+   the end of one faults instead of scribbling over the next */
+constexpr size_t GUARD_SIZE = paging::PAGE_SIZE;
+
+/* sz bytes of zeroed memory backed by order 0 frames, which don't have to be
+   physically contiguous; returns nullptr if there is no space or memory */
+void* alloc(size_t sz);
+
+// free an area returned by alloc
+void free(void* p);
+
+/* map [phys_addr, phys_addr + sz) somewhere in the vmalloc range, uncached
+   unless cache is set; the result has the same offset in its page as phys_addr.
+   cached ranges inside the kernel identity map are returned from there.
+   uncached mappings are meant for device memory: an uncached alias of RAM in
+   the identity map (which is write-back) makes the memory type undefined */
+void* ioremap(const void* phys_addr, size_t sz, bool cache = false);
+
+// remove a mapping made by ioremap (addresses outside the vmalloc range are ignored)
+void iounmap(const void* p);
+
+void dump_stats();
+
+void init();
+
+}
+
+#endif /* _VMALLOC_H_ */
@@ -25,13 +25,16 @@
 #include <memory.h>
 #include <paging.h>
 #include <heap.h>
+#include <slab.h>
+#include <pool.h>
+#include <vmalloc.h>
+#include <dma.h>
 #include <proc.h>
 #include <syscall.h>
 #include <fs.h>
 #include <fs/devfs.h>
 #include <lib/string.h>
-#include <lib/rbtree.h>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 #include <lib/vector.h>
 #include <algorithm>
 #include <memory>
@@ -45,7 +48,7 @@ extern "C" void kmain(volatile multiboot_info* mbd)
     gdt::init();
     idt::init();
 
-    memory::init((mbd->mem_upper + 1024) * 1024);
+    memory::init((const multiboot_info*) mbd);
 
     time::init();
 
@@ -61,6 +64,13 @@ extern "C" void kmain(volatile multiboot_info* mbd)
 
     process::init();
 
+    void* dma = paging::alloc_frames(2, paging::FRAME_DMA);
+    void* kframe = paging::alloc_kernel_frames(3);
+    ASSERT(dma && uint32_t(dma) < paging::ZONE_DMA_END);
+    ASSERT(kframe && uint32_t(kframe) < paging::KERNEL_IDMAP_SIZE);
+    paging::free_frames(dma);
+    paging::free_frames(kframe);
+
     paging::dump_paging_stats();
     console::puts("\n\n");
 
@@ -119,7 +129,7 @@ extern "C" void kmain(volatile multiboot_info* mbd)
     }
     sw_barrier();
 
-    rbtree<int> tree;
+    slab::rbtree<int> tree;
 
     for (int i=2;i<30;i++) {
         for (int j=0;j<1000;j++)
@@ -140,6 +150,228 @@ extern "C" void kmain(volatile multiboot_info* mbd)
 
     console::printf("finish tree\n");
 
+    console::puts("TEST HEAP LATENCY\n");
+    {
+        constexpr int N = 4096;
+        static void* live[N];
+        for (int n = 0; n <= N; n += N/4) {
+            // fragment the heap: allocate blocks of varying sizes, and free every other one
+            for (int i=0;i<n;i++)
+                live[i] = malloc(16 + (i*37)%512);
+            for (int i=0;i<n;i+=2)
+                free(live[i]);
+
+            const uint64_t start = time::rdtsc();
+            for (int i=0;i<1000;i++)
+                free(malloc(24 + (i*13)%256));
+            const uint64_t cycles = time::rdtsc() - start;
+            console::printf("\t%d free blocks: %d cycles per malloc/free\n", n/2, uint32_t(cycles/1000));
+
+            for (int i=1;i<n;i+=2)
+                free(live[i]);
+        }
+    }
+
+    console::puts("TEST SLAB CACHE\n");
+    {
+        static slab::cache test_cache("test", 24, 8, [](void* p) { memset(p, 0xAB, 24); });
+        void* objs[1000];
+        for (int i=0;i<1000;i++)
+            objs[i] = test_cache.alloc();
+        for (int i=0;i<1000;i+=2)
+            test_cache.free(objs[i]);
+        for (int i=0;i<1000;i+=2) {
+            objs[i] = test_cache.alloc();
+            ASSERT(*(uint8_t*)objs[i] == 0xAB);
+        }
+        for (int i=0;i<1000;i++)
+            memory::kfree(objs[i]);
+        test_cache.shrink();
+    }
+    slab::dump_stats();
+
+    console::puts("TEST ATOMIC POOLS\n");
+    {
+        // drain the 64 byte pool the way an interrupt handler would
+        void* objs[100];
+        int n = 0;
+        for (;n<100;n++) {
+            objs[n] = memory::kmalloc(48, memory::KMALLOC_ATOMIC | memory::KMALLOC_ZERO);
+            if (!objs[n]) break;
+            ASSERT(pool::owns(objs[n]) && *(uint32_t*)objs[n] == 0);
+        }
+        ASSERT(n > 0 && pool::refill_pending);
+        for (int i=0;i<n;i++)
+            memory::kfree(objs[i]);
+        free(malloc(16)); // refills from process context
+        ASSERT(!pool::refill_pending);
+    }
+    pool::dump_stats();
+
+    console::puts("TEST VMALLOC\n");
+    {
+        void* areas[16];
+        for (int i=0;i<16;i++) {
+            areas[i] = vmalloc::alloc((i+1) * 0x3000 - 100);
+            ASSERT(areas[i] && *(uint32_t*)areas[i] == 0);
+            memset(areas[i], i, (i+1) * 0x3000 - 100);
+        }
+        for (int i=0;i<16;i+=2)
+            vmalloc::free(areas[i]);
+        // best fit: the smallest hole is the one left by the first area
+        void* small = vmalloc::alloc(0x3000);
+        ASSERT(small == areas[0]);
+        vmalloc::free(small);
+        for (int i=1;i<16;i+=2) {
+            ASSERT(*((uint8_t*)areas[i] + (i+1) * 0x3000 - 101) == i);
+            vmalloc::free(areas[i]);
+        }
+
+        // cached ranges up to the end of the identity map come from there,
+        // uncached ones get their own mapping
+        const void* last = (const void*)(paging::KERNEL_IDMAP_SIZE - 0x1000);
+        ASSERT(vmalloc::ioremap(last, 0x1000, true) == paging::phys_to_virt(last));
+        void* vga = vmalloc::ioremap((const void*)0xB8010, 0x100);
+        ASSERT(uintptr_t(vga) >= vmalloc::VMALLOC_START && (uintptr_t(vga) & 0xfff) == 0x10);
+        vmalloc::iounmap(vga);
+    }
+    vmalloc::dump_stats();
+
+    console::puts("TEST DMA POOL\n");
+    {
+        // 96 byte descriptors that must not cross 512 byte boundaries
+        static dma::pool test_pool("test_desc", 96, 32, 512);
+        void* descs[200];
+        for (int i=0;i<200;i++) {
+            dma::bus_addr_t bus;
+            descs[i] = test_pool.alloc(&bus);
+            ASSERT(descs[i] && bus == uint32_t(paging::virt_to_phys(descs[i])));
+            ASSERT(bus % 32 == 0 && bus / 512 == (bus + 95) / 512);
+        }
+        for (int i=0;i<200;i++)
+            test_pool.free(descs[i]);
+    }
+    dma::dump_stats();
+
+    console::puts("TEST PAGE COLORING\n");
+    {
+        // a working set of half of an 8-way L2 cache: with every color used
+        // equally there are no conflict misses, with random colors there are
+        const uint32_t colors = paging::num_page_colors();
+        const uint32_t n = colors * 4;
+        static paging::pfn_t held[1024], set[paging::MAX_COLORS * 4];
+        const bool was_on = paging::page_coloring();
+        uint32_t seed = 12345;
+
+        for (int on = 0; on <= 1; on++) {
+            paging::set_page_coloring(on);
+            uint32_t min_cycles = ~0u, max_cycles = 0, total = 0, worst = 0;
+            for (int trial = 0; trial < 8; trial++) {
+                // scramble the free lists: give back a random half of many frames
+                for (int i = 0; i < 1024; i++)
+                    held[i] = paging::alloc_pfn(0, paging::FRAME_KERNEL);
+                for (int i = 0; i < 1024; i++) {
+                    seed = seed * 1103515245 + 12345;
+                    const int j = i + (seed >> 8) % (1024 - i);
+                    std::swap(held[i], held[j]);
+                    if ((i & 1) && held[i]) {
+                        paging::free_pfn(held[i]);
+                        held[i] = 0;
+                    }
+                }
+
+                uint32_t per_color[paging::MAX_COLORS] = {};
+                for (uint32_t i = 0; i < n; i++) {
+                    set[i] = paging::alloc_colored_pfn(i, paging::FRAME_KERNEL);
+                    ASSERT(set[i] != 0);
+                    worst = std::max(worst, ++per_color[set[i] & (colors - 1)]);
+                }
+
+                // one line of every 64 bytes, twice so that the second pass can hit
+                volatile uint32_t sum = 0;
+                uint64_t start = 0;
+                for (int pass = 0; pass < 2; pass++) {
+                    if (pass == 1)
+                        start = time::rdtsc();
+                    for (uint32_t i = 0; i < n; i++) {
+                        const uint32_t* page = (const uint32_t*) paging::phys_to_virt((void*)(set[i] << paging::PAGE_SHIFT));
+                        for (uint32_t k = 0; k < paging::PAGE_SIZE / 4; k += 16)
+                            sum += page[k];
+                    }
+                }
+                const uint32_t cycles = uint32_t(time::rdtsc() - start);
+                min_cycles = std::min(min_cycles, cycles);
+                max_cycles = std::max(max_cycles, cycles);
+                total += cycles;
+
+                for (uint32_t i = 0; i < n; i++)
+                    paging::free_pfn(set[i]);
+                for (int i = 0; i < 1024; i++)
+                    if (held[i]) paging::free_pfn(held[i]);
+            }
+            console::printf("\tcoloring %s (%d colors, %d pages): %d-%d cycles per pass, avg %d; "
+                            "at most %d pages of one color\n", on ? "on" : "off", colors, n,
+                            min_cycles, max_cycles, total / 8, worst);
+        }
+        paging::set_page_coloring(was_on);
+    }
+
+    console::puts("TEST COMPACTION\n");
+    {
+        // take every free frame of the DMA zone, and map every even one as a
+        // movable page, so that no free block larger than a frame is left
+        constexpr uint8_t order = 4;
+        constexpr uint32_t base = 0x40000000;
+        static paging::pfn_t taken[paging::ZONE_DMA_END >> paging::PAGE_SHIFT];
+        static paging::page* pages[paging::ZONE_DMA_END >> paging::PAGE_SHIFT];
+        paging::shared_page_dir sdir;
+        sdir.dir = paging::get_current_dir()->clone();
+        paging::switch_page_dir(sdir.dir);
+
+        uint32_t n = 0, mapped = 0;
+        while ((taken[n] = paging::alloc_pfn(0, paging::FRAME_DMA | paging::FRAME_ATOMIC)))
+            n++;
+        for (uint32_t i = 0; i < n; i++) {
+            if (taken[i] & 1) {
+                paging::free_pfn(taken[i]);
+                continue;
+            }
+            const uint32_t vaddr = base + (mapped << paging::PAGE_SHIFT);
+            paging::page* pg = sdir.dir->get_page(vaddr >> paging::PAGE_SHIFT, true,
+                                                  paging::PAGE_PRESENT | paging::PAGE_RW | paging::PAGE_US);
+            pg->value = (paging::pte_t(taken[i]) << paging::PAGE_SHIFT) |
+                        paging::PAGE_PRESENT | paging::PAGE_RW | paging::PAGE_US;
+            paging::set_movable(taken[i], pg);
+            ((uint32_t*)vaddr)[0] = ((uint32_t*)vaddr)[1023] = taken[i];
+            taken[mapped] = taken[i];
+            pages[mapped++] = pg;
+        }
+        ASSERT(mapped > 0);
+
+        // atomic allocations don't compact; once the pages are moved away it works
+        ASSERT(!paging::alloc_pfn(order, paging::FRAME_DMA | paging::FRAME_ATOMIC));
+        ASSERT(paging::compact(order, paging::FRAME_DMA));
+        const paging::pfn_t block = paging::alloc_pfn(order, paging::FRAME_DMA | paging::FRAME_ATOMIC);
+        ASSERT(block && !(block & ((1 << order) - 1)));
+
+        uint32_t moved = 0;
+        for (uint32_t i = 0; i < mapped; i++) {
+            const uint32_t* vaddr = (const uint32_t*)(base + (i << paging::PAGE_SHIFT));
+            const paging::pfn_t frame = pages[i]->addr;
+            ASSERT(pages[i]->present && (frame < block || frame >= block + (1 << order)));
+            ASSERT(vaddr[0] == taken[i] && vaddr[1023] == taken[i]);
+            ASSERT(*(const uint32_t*)paging::phys_to_virt((void*)(frame << paging::PAGE_SHIFT)) == taken[i]);
+            moved += frame != taken[i];
+        }
+        ASSERT(moved > 0);
+        console::printf("\t%d of %d DMA frames mapped, %d moved for an order %d block at %#X\n",
+                        mapped, n, moved, order, block);
+
+        paging::free_pfn(block);
+        paging::unmap_batch(sdir.dir).unmap_range(base, base + (mapped << paging::PAGE_SHIFT));
+        // the destructor of sdir switches back to the kernel directory
+    }
+
     void* frame5 = paging::alloc_frames(5), *frame9 = paging::alloc_frames(9);
     console::printf("an order 5 block location at: %#X\n", (uint32_t)frame5);
     console::printf("an order 9 block location at: %#X\n", (uint32_t)frame9);
@@ -201,7 +433,7 @@ extern "C" void kmain(volatile multiboot_info* mbd)
         console::printf("cap = %u\n", vec.capacity());
     }
 
-    linked_list<int> list;
+    slab::linked_list<int> list;
 
     list.push_back(10);
     list.push_back(60);
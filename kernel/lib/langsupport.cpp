@@ -76,12 +76,12 @@ void __cxa_guard_abort(__guard*) {}
 
 void* operator new(size_t size)
 {
-    return malloc(size);
+    return memory::kmalloc(size, 0, nullptr, __builtin_return_address(0));
 }
 
 void* operator new[](size_t size)
 {
-    return malloc(size);
+    return memory::kmalloc(size, 0, nullptr, __builtin_return_address(0));
 }
 
 void operator delete(void* p)
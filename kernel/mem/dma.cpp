@@ -0,0 +1,210 @@
+/* DMA buffer allocator.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <dma.h>
+#include <memory.h>
+#include <console.h>
+#include <lib/klib.h>
+#include <lib/string.h>
+#include <algorithm>
+
+using std::max;
+using paging::PAGE_SIZE;
+using paging::PAGE_SHIFT;
+
+//#define _DEBUG_DMA_
+
+namespace dma
+{
+
+static pool* pools = nullptr;
+
+static inline size_t align_up(size_t x, size_t align)
+{
+    return (x + align - 1) & ~(align - 1);
+}
+
+// the smallest order of a block of at least sz bytes
+static uint8_t order_of(size_t sz)
+{
+    uint8_t order = 0;
+    while ((PAGE_SIZE << order) < sz)
+        order++;
+    return order;
+}
+
+static inline void*& free_link(void* obj)
+{
+    return *(void**) obj;
+}
+
+void* alloc_coherent(size_t sz, bus_addr_t* bus_addr, uint32_t flags)
+{
+    const uint8_t order = order_of(sz);
+    ASSERTH(order <= paging::BUDDY_MAX_ORDER && (flags & (paging::FRAME_KERNEL | paging::FRAME_DMA)));
+
+    void* phys = paging::alloc_frames(order, flags | paging::FRAME_ZERO);
+    if (unlikely(!phys))
+        return nullptr;
+    if (bus_addr)
+        *bus_addr = bus_addr_t(phys);
+    return paging::phys_to_virt(phys);
+}
+
+void free_coherent(void* vaddr, size_t sz)
+{
+    if (likely(vaddr))
+        paging::free_frames(paging::virt_to_phys(vaddr));
+}
+
+pool::pool(const char* name, size_t size, size_t align, size_t boundary, uint32_t flags)
+    : name(name), size(size), boundary(boundary), flags(flags)
+{
+    if (align < sizeof(void*)) align = sizeof(void*);
+    ASSERTH((align & (align - 1)) == 0 && (boundary & (boundary - 1)) == 0);
+    ASSERTH(!boundary || size <= boundary);
+
+    // the buddy block is aligned to its size, so it has to cover the alignment
+    stride = align_up(max(size, sizeof(void*)), align);
+    order  = order_of(max(stride, align));
+    ASSERTH(order <= paging::BUDDY_MAX_ORDER);
+
+    next_pool = pools;
+    pools = this;
+}
+
+pool::~pool()
+{
+    ASSERTH(num_active == 0);
+    while (chunks) {
+        chunk* c = chunks;
+        chunks = c->next;
+        free_coherent(c->vaddr, PAGE_SIZE << order);
+        delete c;
+    }
+
+    for (pool** p = &pools; *p; p = &(*p)->next_pool) {
+        if (*p == this) {
+            *p = next_pool;
+            break;
+        }
+    }
+}
+
+// add a new chunk with every object free
+pool::chunk* pool::grow()
+{
+    const size_t chunk_size = PAGE_SIZE << order;
+    void* vaddr = alloc_coherent(chunk_size, nullptr, flags);
+    if (unlikely(!vaddr))
+        return nullptr;
+
+    chunk* c = new chunk;
+    if (unlikely(!c)) {
+        free_coherent(vaddr, chunk_size);
+        return nullptr;
+    }
+    c->vaddr = vaddr;
+    c->inuse = 0;
+    c->free_list = nullptr;
+
+    // the bus addresses have the same offsets in the chunk as the virtual
+    // ones, since the block is aligned to its size
+    void** tail = &c->free_list;
+    for (size_t off = 0; off + size <= chunk_size; off += stride) {
+        if (boundary && off / boundary != (off + size - 1) / boundary) {
+            // skip to the next boundary, which is aligned as well
+            off = align_up(off, boundary) - stride;
+            continue;
+        }
+        void* obj = (void*) (uint32_t(vaddr) + off);
+        *tail = obj;
+        tail = &free_link(obj);
+    }
+    *tail = nullptr;
+
+    c->next = chunks;
+    chunks = c;
+    num_chunks++;
+#ifdef _DEBUG_DMA_
+    console::printf("DMA/%s: new chunk at %#X\n", name, uint32_t(vaddr));
+#endif
+    return c;
+}
+
+pool::chunk* pool::find_chunk(const void* vaddr) const
+{
+    const size_t chunk_size = PAGE_SIZE << order;
+    for (chunk* c = chunks; c; c = c->next)
+        if (uint32_t(vaddr) - uint32_t(c->vaddr) < chunk_size)
+            return c;
+    return nullptr;
+}
+
+void* pool::alloc(bus_addr_t* bus_addr)
+{
+    chunk* c = chunks;
+    while (c && !c->free_list)
+        c = c->next;
+    if (!c && unlikely(!(c = grow())))
+        return nullptr;
+
+    void* obj = c->free_list;
+    c->free_list = free_link(obj);
+    c->inuse++;
+
+    memset(obj, 0, size);
+    if (bus_addr)
+        *bus_addr = bus_addr_t(paging::virt_to_phys(obj));
+
+    num_active++;
+    num_allocs++;
+    return obj;
+}
+
+void pool::free(void* vaddr)
+{
+    if (unlikely(!vaddr))
+        return;
+    chunk* c = find_chunk(vaddr);
+    ASSERTH(c != nullptr && c->inuse > 0);
+
+    free_link(vaddr) = c->free_list;
+    c->free_list = vaddr;
+    num_active--;
+
+    // give empty chunks back, except for the last one
+    if (--c->inuse == 0 && num_chunks > 1) {
+        chunk** p = &chunks;
+        while (*p != c)
+            p = &(*p)->next;
+        *p = c->next;
+        free_coherent(c->vaddr, PAGE_SIZE << order);
+        delete c;
+        num_chunks--;
+    }
+}
+
+void dump_stats()
+{
+    console::puts("DMA pools:\n");
+    console::puts("\tname            size  chunk  chunks  active  allocs\n");
+    for (pool* p = pools; p; p = p->next_pool)
+        console::printf("\t%-15s %5d  %5d  %6d  %6d  %6d\n", p->name, p->size, PAGE_SIZE << p->order,
+                        p->num_chunks, p->num_active, p->num_allocs);
+}
+
+}
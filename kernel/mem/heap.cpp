@@ -19,41 +19,166 @@
 #include <paging.h>
 #include <console.h>
 #include <lib/klib.h>
+#include <lib/string.h>
+#include <algorithm>
 
+using std::min;
 using paging::PAGE_SHIFT;
 
 extern "C" paging::page_dir kernel_page_dir; // defined in boot.s
 
 constexpr size_t MIN_BLOCK_SIZE = 8;        // minimum size for block allocation
 constexpr size_t MIN_SREL_SIZE  = 0x100000; // minimum release size
+constexpr size_t MIN_DECOMMIT_SIZE = 0x10000; // minimum size of free blocks to release pages from
 
 //#define _DEBUG_HEAP_
+//#define _DEBUG_HEAP_CHECK_ /* verify block tags on every list operation */
 
 namespace heap
 {
 
 static boundary_header* const heap_base = (boundary_header*) HEAP_BASE;
 
-static boundary_header _list_nil;
-static boundary_header* free_blocks = &_list_nil; // an ordered (by size) linked list of unused blocks
-
 static volatile void* heap_end = (void*) (HEAP_BASE + HEAP_INIT_SIZE);
+// end of the mapped part of the heap; past heap_end up to the end of
+// the last chunk if that is a 4 MiB page
+static uint32_t mapped_end = HEAP_BASE;
 static bool online = false;
 
+/* free blocks are kept in segregated lists: the first level index is log2 of
+   the block size, and each power of two range is split again into SL_COUNT
+   lists. a bitmap of non-empty lists on both levels gives the smallest list
+   that can hold a given size in constant time */
+constexpr uint32_t SL_SHIFT = 3;
+constexpr uint32_t SL_COUNT = 1<<SL_SHIFT;
+
+static boundary_header bins[FL_COUNT][SL_COUNT]; // list sentinels
+static uint32_t fl_bitmap = 0;
+static uint8_t  sl_bitmap[FL_COUNT];
+
+// size of the smallest block that can be split off another block
+constexpr size_t MIN_SPLIT_SIZE = sizeof(boundary_header) + sizeof(boundary_footer) + MIN_BLOCK_SIZE;
+static_assert(MIN_SPLIT_SIZE >= SL_COUNT, "second level index needs at least SL_SHIFT bits");
+
+/* statistics; only counters are updated on alloc and free, everything
+   else is computed when the stats are read */
+static uint32_t bytes_used = 0;
+static uint32_t bytes_peak = 0;
+static uint32_t num_allocs = 0;
+static uint32_t num_frees  = 0;
+static uint32_t num_sbrk   = 0;
+static uint32_t num_srel   = 0;
+static uint32_t num_reallocs = 0;
+static uint32_t num_inplace  = 0;   // reallocs that did not move the block
+static uint32_t num_reclaims = 0;
+static uint32_t pages_decommitted = 0;
+static uint32_t pages_recommitted = 0;
+static uint32_t pages_released    = 0;
+
+static heap_site sites[MAX_SITES];
+
+// get the site table index of caller (an open addressed hash table with short
+// probe sequences; callers that do not fit are accounted to site 0)
+static inline uint8_t get_site(const void* caller)
+{
+    constexpr uint32_t SITE_PROBES = 8;
+    if (!caller)
+        return 0;
+    uint32_t i = (uint32_t(caller) * 2654435761u) >> (32 - __builtin_ctz(MAX_SITES));
+    for (uint32_t n = 0; n < SITE_PROBES; n++, i = (i + 1) & (MAX_SITES - 1)) {
+        if (i == 0)
+            continue;
+        if (sites[i].caller == caller)
+            return i;
+        if (!sites[i].caller) {
+            sites[i].caller = caller;
+            return i;
+        }
+    }
+    return 0;
+}
+
+#ifdef _DEBUG_HEAP_CHECK_
+static void check_block(const boundary_header* h)
+{
+    const boundary_footer* footer = (const boundary_footer*) (uint32_t(h) + h->size - sizeof(boundary_footer));
+    if (unlikely(h->magic != HEAP_HEADER_MAGIC || footer->magic != HEAP_FOOTER_MAGIC || footer->header != h)) {
+        console::printf("h = %#X, h->magic = %#X, h->size = %#X, h->next = %#X, h->prev = %#X\n",
+                        uint32_t(h), uint32_t(h->magic), h->size, uint32_t(h->next), uint32_t(h->prev));
+        PANIC("Kernel heap corrupted");
+    }
+}
+#endif
+
+// get the list that holds blocks of size sz
+static inline void mapping_insert(uint32_t sz, uint32_t& fl, uint32_t& sl)
+{
+    fl = 31 - __builtin_clz(sz);
+    sl = (sz >> (fl - SL_SHIFT)) & (SL_COUNT - 1);
+}
+
+// get the first list in which every block has a size of at least sz
+static inline void mapping_search(uint32_t sz, uint32_t& fl, uint32_t& sl)
+{
+    sz += (1u << (31 - __builtin_clz(sz) - SL_SHIFT)) - 1;
+    mapping_insert(sz, fl, sl);
+}
 
-// insert into the linked list, while preserving order
-static void insert_list(boundary_header* l, boundary_header* x)
+// insert a free block into its list
+static void insert_block(boundary_header* x)
 {
     ASSERTH(!x->used);
-    const boundary_header* start = l;
-    for (l = l->next; l != start && l->size < x->size; l = l->next) {
-        if (unlikely(l->magic != HEAP_HEADER_MAGIC || l->used)) {
-            console::printf("l = %#X, l->magic = %#X, l->next = %#X, l->prev = %#X\n",
-                            uint32_t(l), uint32_t(l->magic), uint32_t(l->next), uint32_t(l->prev));
-            PANIC("Kernel heap corrupted");
-        }
-    };
-    l->prev->insert(x);
+#ifdef _DEBUG_HEAP_CHECK_
+    check_block(x);
+#endif
+    uint32_t fl, sl;
+    mapping_insert(x->size, fl, sl);
+    x->decommitted = false; // the block changed, reclaim() has to look at it again
+    bins[fl][sl].insert(x);
+    fl_bitmap     |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+}
+
+// remove a free block from its list (must be called before changing x->size)
+static void remove_block(boundary_header* x)
+{
+#ifdef _DEBUG_HEAP_CHECK_
+    check_block(x);
+#endif
+    uint32_t fl, sl;
+    mapping_insert(x->size, fl, sl);
+    x->remove();
+    if (bins[fl][sl].next == &bins[fl][sl]) {
+        sl_bitmap[fl] &= ~(1u << sl);
+        if (!sl_bitmap[fl])
+            fl_bitmap &= ~(1u << fl);
+    }
+}
+
+// find a free block of at least sz bytes, or nullptr
+static boundary_header* find_block(uint32_t sz)
+{
+    uint32_t fl, sl;
+    mapping_search(sz, fl, sl);
+    if (unlikely(fl >= FL_COUNT))
+        return nullptr;
+
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) { // nothing in this range, use the next non-empty range
+        const uint32_t fl_map = fl + 1 < FL_COUNT ? fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map)
+            return nullptr;
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    boundary_header* h = bins[fl][sl].next;
+#ifdef _DEBUG_HEAP_CHECK_
+    check_block(h);
+    if (unlikely(h->used || h->size < sz)) PANIC("Kernel heap corrupted");
+#endif
+    return h;
 }
 
 bool is_online()
@@ -61,6 +186,34 @@ bool is_online()
     return online;
 }
 
+// map the heap up to end: whole 4 MiB chunks get a large page if there is
+// a free block for one, the rest is mapped page by page
+static void map_heap(uint32_t end)
+{
+    while (mapped_end < end) {
+        if (!(mapped_end & (paging::LARGE_PAGE_SIZE - 1)) && paging::map_kernel_large(mapped_end)) {
+            mapped_end += paging::LARGE_PAGE_SIZE;
+            continue;
+        }
+        const uint32_t stop = min<uint32_t>(end, (mapped_end | (paging::LARGE_PAGE_SIZE - 1)) + 1);
+        kernel_page_dir.alloc_pages(mapped_end >> PAGE_SHIFT, (stop - mapped_end) >> PAGE_SHIFT);
+        mapped_end = stop;
+    }
+}
+
+static bool commit_page(uint32_t addr);
+
+// map the pages in [start, end) released by reclaim(); returns false if there is no memory
+static bool commit_range(uint32_t start, uint32_t end)
+{
+    if (likely(!pages_released))
+        return true;
+    for (uint32_t a = start & ~0xFFF; a < end; a += 0x1000)
+        if (unlikely(!commit_page(a)))
+            return false;
+    return true;
+}
+
 /* expand heap size */
 static uint32_t sbrk(uint32_t inc)
 {
@@ -71,8 +224,9 @@ static uint32_t sbrk(uint32_t inc)
     uint32_t new_end = memory::align_addr(uint32_t(heap_end) + inc);
     inc = new_end - uint32_t(heap_end);
 
-    kernel_page_dir.alloc_pages(uint32_t(heap_end) >> PAGE_SHIFT, inc >> PAGE_SHIFT);
+    map_heap(new_end);
 
+    num_sbrk++;
     heap_end = (void*) new_end;
     return inc;
 }
@@ -86,18 +240,35 @@ static uint32_t srel(uint32_t dec)
 #ifdef _DEBUG_HEAP_
     console::printf("KHEAP/srel: releasing %d bytes of mem (new_end = %#X)\n", dec, (uint32_t)new_end);
 #endif
-    for (uint32_t i = new_end; i < uint32_t(heap_end);i += 0x1000) {
+    // a large page is only given back as a whole
+    uint32_t start = new_end;
+    if (paging::is_kernel_large(start))
+        start = (start + paging::LARGE_PAGE_SIZE - 1) & ~(paging::LARGE_PAGE_SIZE - 1);
+
+    paging::unmap_batch batch(&kernel_page_dir);
+    for (uint32_t i = start; i < mapped_end; ) {
+        if (paging::is_kernel_large(i)) {
+            batch.unmap_range(i, i + paging::LARGE_PAGE_SIZE);
+            i += paging::LARGE_PAGE_SIZE;
+            continue;
+        }
         auto p     = kernel_page_dir.get_page((void*)i);
-        paging::free_frames((void*) (p->addr << PAGE_SHIFT));
-        p->value = 0;
+        if (!p->present) // released by reclaim()
+            pages_released--;
+        else
+            batch.unmap(i);
+        i += 0x1000;
     }
+    batch.flush();
+    mapped_end = start;
 
     sw_barrier();
+    num_srel++;
     heap_end = (void*) new_end;
     return dec;
 }
 
-void* alloc(uint32_t size, bool align)
+void* alloc(uint32_t size, bool align, const void* caller)
 {
     if (size < MIN_BLOCK_SIZE) size = MIN_BLOCK_SIZE; // enforce minimum block size
 
@@ -106,29 +277,19 @@ void* alloc(uint32_t size, bool align)
     // align to machine boundary
     size = size + ((size % sizeof(uintptr_t)) ? sizeof(uintptr_t) - (size % sizeof(uintptr_t)) : 0);
 
-    // find the smallest unused block that fits
-    auto h = free_blocks->next;
-    bool found = false;
-    for (; h != free_blocks; h = h->next) {
-        if (h->magic != HEAP_HEADER_MAGIC || h->used) PANIC("Kernel heap corrupted");
-        if (align) { // align address first
-            uint32_t start  = uint32_t(h) + sizeof(boundary_header);
-            uint32_t offset = memory::align_addr(start) - start;
-             // make sure we have enough space
-            if ((offset == 0 ||
-                 offset >= MIN_BLOCK_SIZE + sizeof(boundary_footer) + sizeof(boundary_header))
-                 && h->size >= size + offset)
-                found = true;
-        } else if (h->size >= size) found = true;
-        if (found) break;
-    }
+    // an aligned block may need up to a page in front of it, which is
+    // split off as a free block of its own
+    const uint32_t search_size = align ? size + 0x1000 + MIN_SPLIT_SIZE : size;
 
-    if (!found) { // no suitable free blocks found, allocate new pages
+    // find a free block that fits
+    auto h = find_block(search_size);
+
+    if (!h) { // no suitable free blocks found, allocate new pages
         boundary_header* old_end = (boundary_header*) heap_end;
         boundary_footer* footer = (boundary_footer*) (size_t(heap_end) - sizeof(boundary_footer));
         ASSERTH(footer->magic == HEAP_FOOTER_MAGIC);
-        uint32_t allocsz = sbrk(size + align*0x1000/* to be safe */); // request some pages
         if (footer->header->used) { // write a new block after the last footer
+            uint32_t allocsz = sbrk(search_size); // request some pages
             h = old_end;
             h->magic = HEAP_HEADER_MAGIC;
             h->size  = allocsz;
@@ -136,28 +297,44 @@ void* alloc(uint32_t size, bool align)
         } else {
             // rewrite last block
             h = footer->header;
+            remove_block(h);
 
-            h->size += allocsz;
-            h->remove();
+            h->size += sbrk(search_size);
         }
         // write new footer
         footer = (boundary_footer*) (size_t(heap_end) - sizeof(boundary_footer));
         footer->magic  = HEAP_FOOTER_MAGIC;
         footer->header = h;
+
+        // a grown last block may still have pages released by reclaim()
+        if (h != old_end &&
+            unlikely(!commit_range(uint32_t(h), uint32_t(h) + min<uint32_t>(h->size, search_size + sizeof(boundary_header))))) {
+            insert_block(h);
+            return nullptr;
+        }
     } else {
-         h->remove(); // remove from unused list
+        remove_block(h); // remove from unused list
 #ifdef _DEBUG_HEAP_
         console::printf("KHEAP: found block at %#X\n", uint32_t(h));
 #endif
+        // reclaim() may have released pages of the block: map the part that
+        // is used (and the header of the rest) now, instead of failing on
+        // the first touch
+        if (unlikely(!commit_range(uint32_t(h), uint32_t(h) + min<uint32_t>(h->size, search_size + sizeof(boundary_header))))) {
+            insert_block(h);
+            return nullptr;
+        }
     }
 
 
     if (align) { // align block starting address
         uint32_t start  = uint32_t(h) + sizeof(boundary_header);
         uint32_t offset = memory::align_addr(start) - start;
+        if (offset > 0 && offset < MIN_SPLIT_SIZE)
+            offset += 0x1000; // too short for a free block, use the next page
 
         if (offset > 0) { // split block to make the start address aligned
-            ASSERTH(offset >= sizeof(boundary_footer) + sizeof(boundary_header) + MIN_BLOCK_SIZE);
+            ASSERTH(h->size >= size + offset);
 
             boundary_footer* old_footer = (boundary_footer*) (uint32_t(h) + h->size - sizeof(boundary_footer));
             ASSERTH(old_footer->magic == HEAP_FOOTER_MAGIC);
@@ -169,7 +346,7 @@ void* alloc(uint32_t size, bool align)
             footer->magic  = HEAP_FOOTER_MAGIC;
             footer->header = h;
 
-            insert_list(free_blocks, h);
+            insert_block(h);
 
             // write a new block for use
             h = (boundary_header*) (uint32_t(footer) + sizeof(boundary_footer));
@@ -200,16 +377,27 @@ void* alloc(uint32_t size, bool align)
 
         old_footer->header = p;
 
-        // add the new block to the free_blocks list
-        insert_list(free_blocks, p);
+        // add the new block to the free lists
+        insert_block(p);
     }
 
     h->used = true;
 
+    // update statistics
+    h->site = get_site(caller);
+    heap_site& site = sites[h->site];
+    site.allocs++;
+    site.live += h->size;
+    if (site.live > site.peak) site.peak = site.live;
+    num_allocs++;
+    bytes_used += h->size;
+    if (bytes_used > bytes_peak) bytes_peak = bytes_used;
+
     return (void*) ((char*)h + sizeof(boundary_header));
 }
 
-void free(void* p)
+// get the header of the used block at p, or panic
+static boundary_header* get_used_header(void* p)
 {
     if (unlikely(uintptr_t(p) < uintptr_t(heap_base) || uintptr_t(p) >= uintptr_t(heap_end))) {
         PANIC("KHEAP: trying to free a block outside of the heap");
@@ -222,23 +410,48 @@ void free(void* p)
             PANIC("KHEAP: trying to free an already freed block");
         PANIC("KHEAP: trying to free wrong address or corruption");
     }
+    return header;
+}
 
-    /* check for stuff immediately to the right */
+// get the free block immediately to the right of header, or nullptr
+static boundary_header* get_free_right(boundary_header* header)
+{
     boundary_header* right  = (boundary_header*) (size_t(header) + header->size);
     if (uint32_t(right) < uint32_t(heap_end) && right->magic == HEAP_HEADER_MAGIC && right->prev != nullptr) { // is it a block?
         boundary_footer* right_footer = (boundary_footer*) (size_t(right) + right->size - sizeof(boundary_footer));
         if (right_footer->magic == HEAP_FOOTER_MAGIC &&
-            right_footer->header == right && !right->used) { // probably is. merge.
+            right_footer->header == right && !right->used) // probably is.
+            return right;
+    }
+    return nullptr;
+}
+
+// update statistics for a used block changing its size by delta
+static inline void account_resize(boundary_header* header, int32_t delta)
+{
+    heap_site& site = sites[header->site];
+    site.live += delta;
+    if (site.live > site.peak) site.peak = site.live;
+    bytes_used += delta;
+    if (bytes_used > bytes_peak) bytes_peak = bytes_used;
+}
+
+// turn a used block into a free block, merging it with its neighbours
+static void release_block(boundary_header* header)
+{
+    boundary_footer* footer = (boundary_footer*) (size_t(header) + header->size - sizeof(boundary_footer));
+
+    /* check for stuff immediately to the right */
+    if (boundary_header* right = get_free_right(header)) { // merge.
 #ifdef _DEBUG_HEAP_
-            console::printf("KHEAP: Merging block %#X with %#X (right), sz = (%d+%d)\n",
-                        uint32_t(header), uint32_t(right),
-                        header->size, right->size);
+        console::printf("KHEAP: Merging block %#X with %#X (right), sz = (%d+%d)\n",
+                    uint32_t(header), uint32_t(right),
+                    header->size, right->size);
 #endif
-            footer = right_footer;
-            header->size += right->size;
-            right->remove();
-            right->magic = HEAP_HEADER_RM_MAGIC;
-        }
+        footer = (boundary_footer*) (size_t(right) + right->size - sizeof(boundary_footer));
+        header->size += right->size;
+        remove_block(right);
+        right->magic = HEAP_HEADER_RM_MAGIC;
     }
 
     /* check for stuff immediately to the left */
@@ -253,7 +466,7 @@ void free(void* p)
                             uint32_t(header), uint32_t(left),
                             header->size, left->size);
 #endif
-                left->remove();
+                remove_block(left);
                 left->size += header->size;
                 left_footer->magic = HEAP_FOOTER_RM_MAGIC;
                 header = left;
@@ -291,7 +504,96 @@ void free(void* p)
 
     footer->header = header; // correct footer
     header->used = false;
-    insert_list(free_blocks, header);
+    insert_block(header);
+}
+
+void free(void* p)
+{
+    boundary_header* header = get_used_header(p);
+
+    // update statistics
+    sites[header->site].live -= header->size;
+    num_frees++;
+    bytes_used -= header->size;
+
+    release_block(header);
+}
+
+// split the used block header into a block of size bytes, and free the rest
+static void shrink_block(boundary_header* header, uint32_t size)
+{
+    if (header->size < size + MIN_SPLIT_SIZE)
+        return; // the rest is too small to be a block
+
+    boundary_footer* old_footer = (boundary_footer*) (uint32_t(header) + header->size - sizeof(boundary_footer));
+    account_resize(header, -int32_t(header->size - size));
+
+    // make a used block out of the rest, and release it
+    boundary_header* rest = (boundary_header*) (uint32_t(header) + size);
+    rest->magic = HEAP_HEADER_MAGIC;
+    rest->size  = header->size - size;
+    rest->used  = true;
+    rest->prev  = rest->next = nullptr;
+    old_footer->header = rest;
+
+    header->size = size;
+    boundary_footer* footer = (boundary_footer*) (uint32_t(header) + size - sizeof(boundary_footer));
+    footer->magic  = HEAP_FOOTER_MAGIC;
+    footer->header = header;
+
+    release_block(rest);
+}
+
+void* realloc(void* p, uint32_t size, const void* caller)
+{
+    boundary_header* header = get_used_header(p);
+    const uint32_t old_payload = header->size - sizeof(boundary_header) - sizeof(boundary_footer);
+
+    // block size as in alloc
+    uint32_t new_size = size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size;
+    new_size += sizeof(boundary_header) + sizeof(boundary_footer);
+    new_size = (new_size + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+
+    num_reallocs++;
+
+    if (new_size > header->size) {
+        // try to grow in place, by absorbing the free block to the right,
+        // and by expanding the heap if the block is at the end of it
+        boundary_header* right = get_free_right(header);
+        const uint32_t avail = header->size + (right ? right->size : 0);
+        const bool at_end = uint32_t(header) + avail == uint32_t(heap_end);
+        if (avail < new_size && !at_end) {
+            // move the block
+            void* n = alloc(size, false, caller);
+            if (unlikely(!n))
+                return nullptr;
+            memcpy(n, p, old_payload);
+            free(p);
+            return n;
+        }
+
+        const uint32_t old_size = header->size;
+        if (right && unlikely(!commit_range(uint32_t(right), uint32_t(right) +
+                                            min<uint32_t>(right->size, new_size - old_size + sizeof(boundary_header)))))
+            return nullptr;
+        if (right) {
+            remove_block(right);
+            right->magic = HEAP_HEADER_RM_MAGIC;
+            header->size += right->size;
+        }
+        if (header->size < new_size)
+            header->size += sbrk(new_size - header->size);
+
+        boundary_footer* footer = (boundary_footer*) (uint32_t(header) + header->size - sizeof(boundary_footer));
+        footer->magic  = HEAP_FOOTER_MAGIC;
+        footer->header = header;
+        account_resize(header, header->size - old_size);
+    }
+
+    // give back whatever is left over
+    shrink_block(header, new_size);
+    num_inplace++;
+    return p;
 }
 
 void init()
@@ -300,14 +602,19 @@ void init()
     console::printf("KHEAP: init\n");
 #endif
     // allocate frames for kernel heap
-    kernel_page_dir.alloc_pages(HEAP_BASE>>PAGE_SHIFT,
-                                (HEAP_INIT_SIZE>>PAGE_SHIFT));
-
-    // fill out nil header
-    free_blocks->magic = HEAP_HEADER_MAGIC;
-    free_blocks->size  = 0;
-    free_blocks->prev  = free_blocks;
-    free_blocks->next  = free_blocks;
+    map_heap(HEAP_BASE + HEAP_INIT_SIZE);
+
+    // fill out nil headers
+    for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+        for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+            bins[fl][sl].magic = HEAP_HEADER_MAGIC;
+            bins[fl][sl].size  = 0;
+            bins[fl][sl].prev  = &bins[fl][sl];
+            bins[fl][sl].next  = &bins[fl][sl];
+        }
+        sl_bitmap[fl] = 0;
+    }
+    fl_bitmap = 0;
 
     // set up an empty block
     heap_base->magic = HEAP_HEADER_MAGIC;
@@ -320,7 +627,7 @@ void init()
     footer->magic  = HEAP_FOOTER_MAGIC;
     footer->header = heap_base;
 
-    insert_list(free_blocks, heap_base);
+    insert_block(heap_base);
 
 #ifdef _DEBUG_HEAP_
     console::printf("heap_base is at %#X\n", uint32_t(heap_base));
@@ -329,4 +636,150 @@ void init()
     online = true;
 }
 
+// map a frame at the heap page containing addr, if it is not present;
+// returns false if there is no memory
+static bool commit_page(uint32_t addr)
+{
+    auto pg = kernel_page_dir.get_page((void*)addr);
+    ASSERTH(pg != nullptr);
+    if (pg->present)
+        return true;
+    void* frame = paging::alloc_frames();
+    if (unlikely(!frame))
+        return false;
+    pg->value = paging::PAGE_PRESENT | paging::PAGE_RW | paging::PAGE_GLOBAL;
+    pg->addr  = uint32_t(frame) >> PAGE_SHIFT;
+    paging::flush_tlb_entry((void*)(addr & ~0xFFF));
+    pages_recommitted++;
+    pages_released--;
+    return true;
+}
+
+bool handle_fault(void* addr)
+{
+    if (uint32_t(addr) < HEAP_BASE || uint32_t(addr) >= uint32_t(heap_end) ||
+        kernel_page_dir.get_page(addr)->present)
+        return false;
+    if (unlikely(!commit_page(uint32_t(addr))))
+        PANIC("KHEAP: out of memory while mapping a released page");
+    return true;
+}
+
+// release the pages strictly inside the free block h, keeping the pages of
+// the header and the footer
+static void decommit_block(boundary_header* h)
+{
+    const uint32_t start = memory::align_addr(uint32_t(h) + sizeof(boundary_header));
+    const uint32_t end   = (uint32_t(h) + h->size - sizeof(boundary_footer)) & ~0xFFF;
+    paging::unmap_batch batch(&kernel_page_dir);
+    for (uint32_t a = start; a < end; a += 0x1000) {
+        auto pg = kernel_page_dir.get_page((void*)a);
+        if (!pg->present)
+            continue;
+        batch.unmap(a);
+        pages_decommitted++;
+        pages_released++;
+    }
+    h->decommitted = true;
+}
+
+void reclaim()
+{
+    if (unlikely(!online))
+        return;
+    num_reclaims++;
+
+    uint32_t fl, sl;
+    mapping_insert(MIN_DECOMMIT_SIZE, fl, sl);
+    // only look at size classes with large enough blocks
+    for (uint32_t map = fl_bitmap & (~0u << fl); map; map &= map - 1) {
+        fl = __builtin_ctz(map);
+        for (sl = 0; sl < SL_COUNT; sl++)
+            for (auto h = bins[fl][sl].next; h != &bins[fl][sl]; h = h->next)
+                if (!h->decommitted && h->size >= MIN_DECOMMIT_SIZE)
+                    decommit_block(h);
+    }
+}
+
+void get_stats(heap_stats& st)
+{
+    st.heap_size    = uint32_t(heap_end) - HEAP_BASE;
+    st.bytes_used   = bytes_used;
+    st.bytes_peak   = bytes_peak;
+    st.bytes_free   = 0;
+    st.largest_free = 0;
+    st.num_allocs   = num_allocs;
+    st.num_frees    = num_frees;
+    st.num_sbrk     = num_sbrk;
+    st.num_srel     = num_srel;
+    st.num_reallocs = num_reallocs;
+    st.num_inplace  = num_inplace;
+    st.num_reclaims = num_reclaims;
+    st.pages_decommitted = pages_decommitted;
+    st.pages_recommitted = pages_recommitted;
+    st.pages_released    = pages_released;
+
+    for (uint32_t fl = 0; fl < FL_COUNT; fl++) {
+        st.free_count[fl] = st.free_bytes[fl] = 0;
+        for (uint32_t sl = 0; sl < SL_COUNT; sl++) {
+            for (auto h = bins[fl][sl].next; h != &bins[fl][sl]; h = h->next) {
+                st.free_count[fl]++;
+                st.free_bytes[fl] += h->size;
+                if (h->size > st.largest_free) st.largest_free = h->size;
+            }
+        }
+        st.bytes_free += st.free_bytes[fl];
+    }
+}
+
+const heap_site* get_sites()
+{
+    return sites;
+}
+
+size_t print_stats(char* buf, size_t size)
+{
+    heap_stats st;
+    get_stats(st);
+
+    size_t len = 0;
+    auto print = [&](const char* fmt, auto... args) {
+        if (len < size)
+            len += console::snprintf(buf + len, size - len, fmt, args...);
+    };
+
+    // external fragmentation: the part of the free memory that can't be
+    // used for an allocation as large as the largest free block
+    const uint32_t frag = st.bytes_free ? 100 - uint32_t(uint64_t(st.largest_free) * 100 / st.bytes_free) : 0;
+
+    print("heap size:     %u\n", st.heap_size);
+    print("used:          %u (peak %u)\n", st.bytes_used, st.bytes_peak);
+    print("free:          %u\n", st.bytes_free);
+    print("largest free:  %u\n", st.largest_free);
+    print("fragmentation: %u%%\n", frag);
+    print("allocs:        %u\n", st.num_allocs);
+    print("frees:         %u\n", st.num_frees);
+    print("sbrk:          %u\n", st.num_sbrk);
+    print("srel:          %u\n", st.num_srel);
+    print("reallocs:      %u (%u in place)\n", st.num_reallocs, st.num_inplace);
+    print("reclaim:       %u passes, %u pages released, %u mapped again, %u pages (%u bytes) released now\n",
+          st.num_reclaims, st.pages_decommitted, st.pages_recommitted,
+          st.pages_released, st.pages_released << PAGE_SHIFT);
+
+    print("\nfree blocks by size:\n");
+    for (uint32_t fl = 0; fl < FL_COUNT; fl++)
+        if (st.free_count[fl])
+            print("  >= %10u: %6u blocks %10u bytes\n", 1u << fl, st.free_count[fl], st.free_bytes[fl]);
+
+    print("\ncall sites:\n");
+    print("  caller        allocs        live        peak\n");
+    for (uint32_t i = 0; i < MAX_SITES; i++)
+        if (sites[i].allocs)
+            print("  %p %10u  %10u  %10u\n", sites[i].caller, sites[i].allocs, sites[i].live, sites[i].peak);
+
+    if (len >= size)
+        len = size - 1; // truncated
+    return len;
+}
+
 }
@@ -17,8 +17,13 @@
 #include <memory.h>
 #include <paging.h>
 #include <heap.h>
+#include <slab.h>
+#include <pool.h>
+#include <vmalloc.h>
 #include <proc.h>
 #include <console.h>
+#include <errno.h>
+#include <sys/mman.h>
 
 //#define _DEBUG_KMALLOC_
 
@@ -36,19 +41,36 @@ void* get_placement_addr()
     return placement_addr;
 }
 
-void* kmalloc(size_t sz, uint32_t flags, void** phys_addr)
+void* kmalloc(size_t sz, uint32_t flags, void** phys_addr, const void* caller)
 {
     const bool align = flags & KMALLOC_ALIGN;
     const bool zero  = flags & KMALLOC_ZERO;
 
     void* ptr = nullptr;
 
+    if (flags & KMALLOC_ATOMIC) {
+        ASSERTH(!align);
+        ptr = pool::alloc(sz);
+        if (unlikely(!ptr))
+            return nullptr;
+        if (phys_addr)
+            *phys_addr = paging::virt_to_phys(ptr);
+        if (zero)
+            memset(ptr, 0, sz);
+        return ptr;
+    }
+
+    // we are in process context, top up the atomic pools if needed
+    if (unlikely(pool::refill_pending))
+        pool::refill();
+
     if (likely(heap::is_online())) {
-        ptr = heap::alloc(sz, align);
-        if (phys_addr) {
+        ptr = heap::alloc(sz, align, caller ? caller : __builtin_return_address(0));
+        if (phys_addr && ptr) {
+            // allocated blocks are always mapped
             auto pg = kernel_page_dir.get_page(ptr);
             ASSERTH(pg != nullptr);
-            *phys_addr = (void*) ((pg->addr << 12) + (uint32_t(ptr) & 0xFFF));
+            *phys_addr = (void*) ((uint32_t(pg->addr) << 12) + (uint32_t(ptr) & 0xFFF));
         }
     } else {
         // the heap is not online yet, place stuff at temporary address
@@ -77,82 +99,242 @@ void kfree(void* p)
 #ifdef _DEBUG_KMALLOC_
     console::printf("kfree called\n");
 #endif
-    if (heap::is_online()) heap::free(p);
+    if (slab::owns(p)) {
+        if (pool::owns(p)) pool::free(p);
+        else slab::free_object(p);
+    } else if (heap::is_online()) heap::free(p);
 }
 
-
-void* remap(const void* phys_addr, size_t sz, bool cache)
+static void* _krealloc(void* p, size_t sz, const void* caller)
 {
-    static size_t curpos = heap::HEAP_END;
-
-    if (cache && (size_t(phys_addr) + sz) < paging::KERNEL_IDMAP_SIZE)
-        return (void*) (size_t(phys_addr) + KERNEL_VIRTUAL_BASE);
-    else if (size_t(phys_addr) < paging::KERNEL_IDMAP_SIZE)
+    if (!p)
+        return kmalloc(sz, 0, nullptr, caller);
+    if (!sz) {
+        kfree(p);
         return nullptr;
-    // ALign sz and phys_addr to 4KiB.
-    sz += size_t(phys_addr) & 0xFFF;
-    phys_addr = (void*)(size_t(phys_addr) & ~0xFFF); // Round down phys_addr.
-    sz = align_addr(sz); // Round up sz.
+    }
 
-    if (REMAP_END - curpos <= sz)
-        return nullptr;
+    if (likely(heap::is_online() && uintptr_t(p) >= heap::HEAP_BASE))
+        return heap::realloc(p, sz, caller);
 
-    if (!kernel_page_dir.map_block(
-            (void*)curpos, phys_addr, sz, /*make_table*/false,
-            paging::PAGE_PRESENT | paging::PAGE_RW |
-            (cache ? 0 : (paging::PAGE_WRITETHROUGH | paging::PAGE_NOCACHE))))
-        return nullptr;
+    // slab objects and blocks from the placement allocator can't be resized;
+    // the size of the latter is unknown, but the placement area is contiguous,
+    // so copying sz bytes is always safe
+    size_t old_sz = sz;
+    if (slab::owns(p)) {
+        old_sz = slab::object_size(p);
+        if (sz <= old_sz)
+            return p;
+    }
+    void* n = kmalloc(sz, 0, nullptr, caller);
+    if (likely(n)) {
+        memcpy(n, p, old_sz < sz ? old_sz : sz);
+        if (slab::owns(p)) // placement memory is never freed
+            kfree(p);
+    }
+    return n;
+}
 
-    void* const pos = (void*)curpos;
-    curpos += sz;
-    return pos;
+void* krealloc(void* p, size_t sz)
+{
+    return _krealloc(p, sz, __builtin_return_address(0));
 }
 
-void init(uint32_t mem_size)
+
+void* remap(const void* phys_addr, size_t sz, bool cache)
 {
-    if (mem_size < (1<<25)) PANIC("At least 32MiB of memory is required");
-    paging::init(mem_size);
+    return vmalloc::ioremap(phys_addr, sz, cache);
+}
+
+// frames above this are ignored (the frame numbers have to fit in the entries)
+#ifdef CONFIG_PAE
+static constexpr uint64_t MAX_FRAMES = uint64_t(1) << (36 - paging::PAGE_SHIFT);
+#else
+static constexpr uint64_t MAX_FRAMES = uint64_t(1) << (32 - paging::PAGE_SHIFT);
+#endif
+static constexpr int MAX_RANGES = 32;
+
+void init(const multiboot_info* mbd)
+{
+    // usable physical memory, from the BIOS memory map if the loader gave us one
+    static paging::phys_range ranges[MAX_RANGES];
+    int num_ranges = 0;
+    paging::pfn_t frames = 0;
+
+    if (mbd->flags & MULTIBOOT_INFO_MEM_MAP) {
+        for (uint32_t off = 0; off < mbd->mmap_length && num_ranges < MAX_RANGES; ) {
+            auto e = (const multiboot_mmap_entry*) paging::phys_to_virt((void*) (mbd->mmap_addr + off));
+            off += e->size + sizeof(e->size);
+            if (e->type != MULTIBOOT_MEMORY_AVAILABLE)
+                continue;
+            const uint64_t start = (e->addr + paging::PAGE_SIZE - 1) >> paging::PAGE_SHIFT;
+            uint64_t end = (e->addr + e->len) >> paging::PAGE_SHIFT;
+            if (end > MAX_FRAMES) end = MAX_FRAMES;
+            if (start >= end)
+                continue;
+            ranges[num_ranges++] = {paging::pfn_t(start), paging::pfn_t(end)};
+            if (end > frames) frames = end;
+        }
+    }
+    if (!num_ranges) {
+        // everything from 1MiB up to mem_upper
+        frames = ((mbd->mem_upper + 1024) * 1024) >> paging::PAGE_SHIFT;
+        ranges[num_ranges++] = {0x100, frames};
+    }
+
+    if (frames < ((1<<25) >> paging::PAGE_SHIFT)) PANIC("At least 32MiB of memory is required");
+    paging::init(frames, ranges, num_ranges);
 
 #ifdef _DEBUG_KMALLOC_
     console::printf("Total allocated before heap is active: %d B (pb = %#X - %#X)\n", (uint32_t(placement_addr) - uint32_t(&_kernel_end)), (uint32_t) placement_addr, (uint32_t) &_kernel_end);
 #endif
 
     heap::init();
+    slab::init();
+    pool::init();
+    vmalloc::init();
 }
 
 
-/* system call */
+/* system calls */
+
+// mmap doesn't place mappings closer to the user stack than this
+static constexpr uintptr_t MMAP_STACK_GAP = 0x100000;
+
 void* brk(void* addr)
 {
     auto p = process::get_current_proc();
     const auto vaddr = (uintptr_t)addr;
-    if (vaddr < (uintptr_t)p->brk_start ||
-        vaddr >= (uintptr_t)p->stack_bot ||
-        vaddr == (uintptr_t)p->brk_end)
-        return p->brk_end;
-    if (vaddr > (uintptr_t)p->brk_end) {
-        // allocate new memory
-        const auto vaddr_start = uintptr_t(p->brk_end) & ~(paging::PAGE_SIZE - 1);
-        const auto vaddr_end = memory::align_addr(vaddr);
-        if (!p->dir->dir->alloc_block((void*)vaddr_start,
-                                      vaddr_end - vaddr_start,
-                                      paging::PAGE_PRESENT|paging::PAGE_US|paging::PAGE_RW)) {
-            // TODO cleanup
-            return p->brk_end;
-        }
-    } else {
+    if (vaddr < (uintptr_t)p->dir->brk_start ||
+        vaddr >= (uintptr_t)p->dir->stack_bot ||
+        vaddr == (uintptr_t)p->dir->brk_end)
+        return p->dir->brk_end;
+
+    const auto old_end = memory::align_addr((uintptr_t)p->dir->brk_end);
+    const auto new_end = memory::align_addr(vaddr);
+    if (new_end > old_end) {
+        // the new pages are mapped when first touched (see paging::fault_in)
+        if (p->dir->vmas.overlaps(old_end, new_end) ||
+            !p->dir->vmas.map(old_end, new_end, PROT_READ | PROT_WRITE))
+            return p->dir->brk_end;
+    } else if (new_end < old_end) {
         // free pages
-        const auto vaddr_start = (uintptr_t)vaddr & ~(paging::PAGE_SIZE - 1);
-        const auto vaddr_end = memory::align_addr((uintptr_t)p->brk_end);
-        for (auto a = vaddr_start; a < vaddr_end; a += paging::PAGE_SIZE) {
-            p->dir->dir->free_page((void*)a);
-        }
+        if (!p->dir->vmas.unmap(new_end, old_end))
+            return p->dir->brk_end;
+        paging::unmap_batch(p->dir->dir).unmap_range(new_end, old_end);
     }
-    p->brk_end = addr;
-    paging::switch_page_dir(p->dir->dir); // flush page dir
+    p->dir->brk_end = addr;
     return addr;
 }
 
+void* mmap(void* addr, size_t len, int prot, int flags)
+{
+    auto p = process::get_current_proc();
+    // only anonymous private mappings are supported for now
+    if (!len || (flags & MAP_SHARED) || !(flags & MAP_ANONYMOUS) ||
+        (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)))
+        return (void*) -EINVAL;
+
+    const uintptr_t vaddr = (uintptr_t)addr;
+    len = align_addr(len);
+    if (!len)
+        return (void*) -ENOMEM;
+
+    uintptr_t start;
+    if (flags & MAP_FIXED) {
+        if ((vaddr & 0xFFF) || vaddr >= KERNEL_VIRTUAL_BASE ||
+            len > KERNEL_VIRTUAL_BASE - vaddr)
+            return (void*) -EINVAL;
+        start = vaddr;
+    } else {
+        const uintptr_t low  = align_addr((uintptr_t)p->dir->brk_end);
+        const uintptr_t high = (uintptr_t)p->dir->stack_bot - MMAP_STACK_GAP;
+        const uintptr_t hint = vaddr & ~0xFFF;
+        if (hint >= low && hint < high && len <= high - hint &&
+            !p->dir->vmas.overlaps(hint, hint + len))
+            start = hint;
+        else if (!(start = p->dir->vmas.find_free(len, low, high)))
+            return (void*) -ENOMEM;
+    }
+
+    if (!p->dir->vmas.map(start, start + len, prot))
+        return (void*) -ENOMEM;
+
+    if (flags & MAP_FIXED) {
+        // drop whatever was mapped there before
+        paging::unmap_batch(p->dir->dir).unmap_range(start, start + len);
+    }
+    return (void*)start;
+}
+
+int munmap(void* addr, size_t len)
+{
+    auto p = process::get_current_proc();
+    const uintptr_t vaddr = (uintptr_t)addr;
+    len = align_addr(len);
+    if ((vaddr & 0xFFF) || !len || vaddr >= KERNEL_VIRTUAL_BASE ||
+        len > KERNEL_VIRTUAL_BASE - vaddr)
+        return -EINVAL;
+
+    if (!p->dir->vmas.unmap(vaddr, vaddr + len))
+        return -ENOMEM;
+
+    paging::unmap_batch(p->dir->dir).unmap_range(vaddr, vaddr + len);
+    return 0;
+}
+
+int mprotect(void* addr, size_t len, int prot)
+{
+    auto p = process::get_current_proc();
+    const uintptr_t vaddr = (uintptr_t)addr;
+    len = align_addr(len);
+    if ((vaddr & 0xFFF) || (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) ||
+        vaddr >= KERNEL_VIRTUAL_BASE || len > KERNEL_VIRTUAL_BASE - vaddr)
+        return -EINVAL;
+    if (!p->dir->vmas.covers(vaddr, vaddr + len))
+        return -ENOMEM;
+    if (!p->dir->vmas.protect(vaddr, vaddr + len, prot))
+        return -ENOMEM;
+
+    // update the pages that are already there; the rest picks up the new
+    // protection when it's faulted in
+    auto dir = p->dir->dir;
+    paging::unmap_batch batch(dir);
+    for (auto a = vaddr; a < vaddr + len; a += paging::PAGE_SIZE) {
+        if (dir->is_large(a)) {
+            if (!(a & (paging::LARGE_PAGE_SIZE - 1)) && vaddr + len - a >= paging::LARGE_PAGE_SIZE) {
+                // large pages are never shared, so they can be made writable right away
+                const auto idx = paging::page_dir::dir_index(a);
+                dir->entries[idx].rw    = prot & PROT_WRITE;
+                dir->entries[idx].user  = prot != PROT_NONE;
+                dir->entries[idx].value = (dir->entries[idx].value & ~paging::PAGE_NX) | paging::nx_flag(prot);
+                batch.invalidate(a);
+                a += paging::LARGE_PAGE_SIZE - paging::PAGE_SIZE;
+                continue;
+            }
+            dir->split_large(a);
+        }
+        if (!dir->tables[paging::page_dir::dir_index(a)]) {
+            a = (a & ~(paging::LARGE_PAGE_SIZE - 1)) + paging::LARGE_PAGE_SIZE - paging::PAGE_SIZE;
+            continue;
+        }
+        auto pg = dir->get_page((void*)a);
+        if (!pg || !pg->present)
+            continue;
+        if (!(prot & PROT_WRITE))
+            pg->value &= ~(paging::PAGE_RW | paging::PAGE_COW);
+        else if (!pg->rw)
+            pg->value |= paging::PAGE_COW; // the write fault decides whether to copy
+        if (prot == PROT_NONE)
+            pg->value &= ~paging::PAGE_US;
+        else
+            pg->value |= paging::PAGE_US;
+        pg->value = (pg->value & ~paging::PAGE_NX) | paging::nx_flag(prot);
+        batch.invalidate(a);
+    }
+    return 0;
+}
+
 }
 
 extern "C"
@@ -160,7 +342,12 @@ extern "C"
 
 void* malloc(size_t sz)
 {
-    return memory::kmalloc(sz);
+    return memory::kmalloc(sz, 0, nullptr, __builtin_return_address(0));
+}
+
+void* realloc(void* p, size_t sz)
+{
+    return memory::_krealloc(p, sz, __builtin_return_address(0));
 }
 
 void free(void* p)
@@ -23,8 +23,10 @@
 #include <proc.h>
 #include <signal.h>
 #include <algorithm>
+#include <sys/mman.h>
 
 using std::min;
+using std::max;
 
 extern "C" uint32_t _kernel_end;            /* defined in kernel.ld */
 
@@ -36,12 +38,124 @@ extern "C" uint32_t _kernel_end;            /* defined in kernel.ld */
 namespace paging
 {
 
-static page_list_entry* page_entries;
-static page_list buddy_lists[BUDDY_MAX_ORDER + 1];
+static page_list_entry* page_entries;           /* one per frame */
 
-static uint32_t memory_size;
+static zone zones[NUM_ZONES];
+
+/* zones to try for each kind of allocation, in order of preference */
+static const zone_type fallback_user[]    = {ZONE_PAE, ZONE_HIGHMEM, ZONE_NORMAL, ZONE_DMA};
+static const zone_type fallback_highmem[] = {ZONE_HIGHMEM, ZONE_NORMAL, ZONE_DMA};
+static const zone_type fallback_kernel[]  = {ZONE_NORMAL, ZONE_DMA};
+static const zone_type fallback_dma[]     = {ZONE_DMA};
+
+static pfn_t memory_frames;
 static page_dir* cur_dir;
 
+// whether the NX bit can be used (PAE with EFER.NXE set)
+static bool nx_enabled = false;
+
+// start of the memory managed by the buddy allocator (in the identity map);
+// 0 until the buddy allocator is set up
+static uint32_t frames_start = 0;
+
+// a small cache of free page table frames, so that clone() and exit() do not
+// go through the buddy allocator for every table
+constexpr uint32_t TABLE_CACHE_SIZE = 16;
+static page_table* table_cache[TABLE_CACHE_SIZE];
+static uint32_t table_cache_count = 0;
+static uint32_t table_cache_hits = 0, table_cache_misses = 0;
+
+/* frames zeroed while the CPU is idle, so that zeroed allocations (page
+   tables, user pages) do not have to clear them on the spot */
+constexpr uint32_t ZERO_POOL_MAX = 128;
+struct zero_pool
+{
+    uint32_t flags;             /* the frames are allocated with these flags */
+    uint32_t capacity;
+    uint32_t count = 0;
+    pfn_t    frames[ZERO_POOL_MAX] = {};
+
+    /* statistics */
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+};
+
+static zero_pool zero_pools[] = {
+    { FRAME_KERNEL, 32 },           // page tables
+    { FRAME_USER, ZERO_POOL_MAX },  // user pages
+};
+
+/* page coloring: lists of free order 0 frames of each color, linked through
+   their descriptors like the buddy lists */
+struct color_pool
+{
+    uint32_t flags;             /* the frames are allocated with these flags */
+    page_list_entry lists[MAX_COLORS] = {};
+    uint32_t count = 0;
+
+    /* statistics */
+    uint32_t hits = 0;
+    uint32_t misses = 0;        /* no frame of the color, any frame was used */
+};
+
+static color_pool color_pools[] = {
+    { FRAME_KERNEL },
+    { FRAME_USER },
+};
+
+#ifdef CONFIG_PAGE_COLORING
+static bool coloring_enabled = true;
+#else
+static bool coloring_enabled = false;
+#endif
+static uint32_t num_colors  = 1;    /* a power of two */
+static uint8_t  color_order = 0;    /* log2(num_colors) */
+
+/* copy-on-write statistics */
+static uint32_t cow_shared = 0;     /* pages shared by clone() */
+static uint32_t cow_copies = 0;     /* write faults that copied the page */
+static uint32_t cow_reuses = 0;     /* write faults on the last reference */
+
+/* unmap batching statistics */
+static uint32_t batch_flushes  = 0; /* batches flushed */
+static uint32_t batch_invlpgs  = 0; /* ... with invlpg */
+static uint32_t batch_full     = 0; /* ... with a full TLB flush */
+static uint32_t batch_pages    = 0; /* pages in all batches */
+
+/* demand-zero statistics */
+static uint32_t lazy_zero_maps  = 0; /* read faults that mapped the zero page */
+static uint32_t lazy_allocs     = 0; /* write faults that mapped a new frame */
+
+/* large page statistics */
+static uint32_t large_maps      = 0; /* user and heap chunks mapped with a large page */
+static uint32_t large_fallbacks = 0; /* ... that fell back to 4 KiB pages */
+static uint32_t large_copies    = 0; /* copied by clone() */
+static uint32_t large_splits    = 0; /* split into 4 KiB pages */
+
+/* kmap statistics */
+static uint32_t kmap_direct = 0;    /* frames found in the identity map */
+static uint32_t kmap_slots  = 0;    /* frames mapped into a kmap slot */
+
+/* compaction statistics */
+static uint32_t compact_runs     = 0; /* blocks chosen for compaction */
+static uint32_t compact_success  = 0; /* ... that became free */
+static uint32_t compact_migrated = 0; /* frames moved */
+
+// mapped read-only wherever lazily allocated memory is read before it is written
+static pfn_t zero_page = 0;
+
+// kmap slots in use; they are taken and released like a stack
+static int kmap_top = 0;
+
+// start of highmem page table
+constexpr int KERNEL_HIGHMEM_START = uint32_t(KERNEL_VIRTUAL_BASE) >> PAGE_TABLE_SHIFT;
+// first directory entry of the kernel heap
+constexpr uint32_t KERNEL_HEAP_START = uint32_t(KERNEL_VIRTUAL_BASE + KERNEL_IDMAP_SIZE) >> PAGE_TABLE_SHIFT;
+
+// end of the kernel heap entries that have ever become 4 MiB pages; only
+// these can differ between directories
+static uint32_t kernel_entries_end = KERNEL_HEAP_START;
+
 static inline uint32_t get_buddy(uint32_t x, uint8_t order)
 {
     return x ^ (1<<order);
@@ -54,8 +168,9 @@ void set_page_dir(page_dir* dir)
 
 void switch_page_dir(page_dir* dir)
 {
+    sync_kernel_entries(dir);
     cur_dir = dir;
-    uint32_t addr = (uint32_t) dir->phys_addr;
+    uint32_t addr = dir->cr3();
 
 #ifdef _DEBUG_PAGING_
     console::printf("PAGING/switch_page_dir: phys_addr = 0x%xu\n", addr);
@@ -69,68 +184,394 @@ page_dir* get_current_dir()
     return cur_dir;
 }
 
-// allocate 2**order continuous pages, return physical address
-void* alloc_frames(uint8_t order)
+void sync_kernel_entries(page_dir* dir)
+{
+    for (uint32_t i = KERNEL_HEAP_START; i < kernel_entries_end; i++)
+        dir->entries[i].value = kernel_page_dir.entries[i].value;
+}
+
+// change the entry of a kernel heap chunk in kernel_page_dir and in the
+// loaded directory; the others are updated by sync_kernel_entries()
+static void set_kernel_entry(uint32_t idx, pte_t value)
+{
+    kernel_page_dir.entries[idx].value = value;
+    page_dir::current_loaded()->entries[idx].value = value;
+    kernel_entries_end = max(kernel_entries_end, idx + 1);
+    flush_tlb_entry((void*)(idx << PAGE_TABLE_SHIFT));
+}
+
+bool is_kernel_large(uint32_t vaddr)
+{
+    const uint32_t idx = page_dir::dir_index(vaddr);
+    return idx >= KERNEL_HEAP_START && kernel_page_dir.entries[idx].ps;
+}
+
+bool map_kernel_large(uint32_t vaddr)
+{
+    const uint32_t idx = page_dir::dir_index(vaddr);
+    page_table* const table = kernel_page_dir.tables[idx];
+    ASSERTH(!(vaddr & (LARGE_PAGE_SIZE - 1)) && idx >= KERNEL_HEAP_START && table &&
+            !kernel_page_dir.entries[idx].ps);
+
+    const pfn_t block = alloc_pfn(LARGE_PAGE_ORDER, 0);
+    if (!block) {
+        large_fallbacks++;
+        return false;
+    }
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
+        table->pages[i].value = (pte_t(block + i) << PAGE_SHIFT) | PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL;
+    set_kernel_entry(idx, (pte_t(block) << PAGE_SHIFT) | PAGE_DIR_4M | PAGE_PRESENT | PAGE_RW | PAGE_GLOBAL);
+    large_maps++;
+    return true;
+}
+
+// go back to the page table of a kernel heap chunk, which maps the same frames
+static void split_kernel_large(uint32_t vaddr)
+{
+    const uint32_t idx = page_dir::dir_index(vaddr);
+    split_frames(kernel_page_dir.entries[idx].addr);
+    set_kernel_entry(idx, uint32_t(virt_to_phys(kernel_page_dir.tables[idx])) | PAGE_PRESENT | PAGE_RW);
+    large_splits++;
+}
+
+static inline zone& zone_of(pfn_t idx)
+{
+    return zones[page_entries[idx].zone()];
+}
+
+// add a free block to the buddy list of its zone
+static inline void buddy_insert(zone& z, uint8_t order, uint32_t idx)
+{
+    page_list_entry* entry = page_entries + idx;
+    entry->order = order;
+    entry->set_flag(page_list_entry::FREE, true);
+    z.lists[order].nil.insert(entry);
+    z.lists[order].num_avail++;
+    z.free += 1<<order;
+}
+
+static pfn_t zone_alloc(zone& z, uint8_t order)
 {
-    ASSERTH(order <= BUDDY_MAX_ORDER);
-#ifdef _DEBUG_PAGING_
-    console::printf("PAGING/alloc_frames: allocating a block with order %d\n", order);
-#endif
     // find a suitable page block
     int x = order;
-    for (; x <= BUDDY_MAX_ORDER && buddy_lists[x].nil.next == &buddy_lists[x].nil; x++) ;
-    if (x > BUDDY_MAX_ORDER) return nullptr;
+    for (; x <= BUDDY_MAX_ORDER && z.lists[x].nil.next == &z.lists[x].nil; x++) ;
+    if (x > BUDDY_MAX_ORDER) return 0;
 
-    page_list_entry* entry = buddy_lists[x].nil.next;
+    page_list_entry* entry = z.lists[x].nil.next;
     entry->remove();
-    buddy_lists[x].num_avail--;
+    z.lists[x].num_avail--;
+    z.free -= 1<<x;
     uint32_t idx = uint32_t(entry - page_entries);
+    entry->set_flag(page_list_entry::FREE, false);
 
     // split the block into buddies until we get a block of size 2**order
-    for (x--; x >= order; x--) {
-        uint32_t idx_buddy = get_buddy(idx, x);
-        // add the buddy block to the list
-        page_entries[idx_buddy].order = x;
-        buddy_lists[x].nil.insert(page_entries + idx_buddy);
-        buddy_lists[x].map->set(idx_buddy >> x);
-        buddy_lists[x].num_avail++;
-    }
+    for (x--; x >= order; x--)
+        buddy_insert(z, x, get_buddy(idx, x)); // add the buddy block to the list
 
     // set block
     entry->order = order;
-    buddy_lists[order].map->clear(idx >> order);
+    z.num_allocs++;
 
 #ifdef _DEBUG_PAGING_
-    console::printf("PAGING/alloc_frames: found a block of order %d at page %d\n", entry->order, idx);
+    console::printf("PAGING/alloc_frames: found a block of order %d at page %d in %s\n", entry->order, idx, z.name);
 #endif
 
-    return (void*) (idx << PAGE_SHIFT); // return physical address
+    return idx;
 }
 
-// free pages located at physical address p
-uint32_t free_frames(void* p)
+// the zones an allocation with the given flags may use, in order of preference
+static inline const zone_type* get_zone_order(uint32_t flags, int& n)
+{
+    if (flags & FRAME_DMA) {
+        n = sizeof(fallback_dma) / sizeof(fallback_dma[0]);
+        return fallback_dma;
+    } else if (flags & FRAME_KERNEL) {
+        n = sizeof(fallback_kernel) / sizeof(fallback_kernel[0]);
+        return fallback_kernel;
+    } else if (flags & FRAME_USER) {
+        n = sizeof(fallback_user) / sizeof(fallback_user[0]);
+        return fallback_user;
+    }
+    n = sizeof(fallback_highmem) / sizeof(fallback_highmem[0]);
+    return fallback_highmem;
+}
+
+// keep_low: respect the low watermark of every zone
+static pfn_t buddy_alloc(uint8_t order, uint32_t flags, bool keep_low = false)
 {
 #ifdef _DEBUG_PAGING_
-    console::printf("PAGING/free_frames called with p at %#X\n", (uint32_t) p);
+    console::printf("PAGING/alloc_frames: allocating a block with order %d, flags %#x\n", order, flags);
 #endif
 
-    ASSERTH(uint32_t(p) < memory_size);
+    int n;
+    const zone_type* order_list = get_zone_order(flags, n);
+
+    // the first pass keeps the low watermark of the zones we fall back to,
+    // so that highmem allocations do not eat up the identity map; the second
+    // one only keeps the min watermark (if we are not atomic)
+    const uint32_t sz = 1<<order;
+    for (int pass = 0; pass < (keep_low ? 1 : 2); pass++) {
+        for (int i = 0; i < n; i++) {
+            zone& z = zones[order_list[i]];
+            uint32_t reserve = (pass == 0 && (i > 0 || keep_low)) ? z.wmark_low : z.wmark_min;
+            if (flags & FRAME_ATOMIC) reserve = 0;
+            if (z.free < sz + reserve)
+                continue;
+            pfn_t p = zone_alloc(z, order);
+            if (likely(p)) {
+                if (i > 0) z.num_fallbacks++;
+                return p;
+            }
+        }
+    }
+
+    return 0;
+}
 
-    uint32_t idx = uint32_t(p) >> PAGE_SHIFT;
+// zero 2**order frames starting at pfn
+static void zero_frames(pfn_t pfn, uint8_t order)
+{
+    const uint32_t n = 1 << order;
+    if (pfn + n <= KERNEL_IDMAP_FRAMES) {
+        memsetd(phys_to_virt((void*)(pfn << PAGE_SHIFT)), 0, (n << PAGE_SHIFT) >> 2);
+        return;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        zero_frame(pfn + i);
+}
+
+// the user pool may hold frames above 4GiB, so only user pages use it
+static inline zero_pool* get_zero_pool(uint32_t flags)
+{
+    if (flags & FRAME_DMA)
+        return nullptr;
+    if (flags & FRAME_KERNEL)
+        return &zero_pools[0];
+    return (flags & FRAME_USER) ? &zero_pools[1] : nullptr;
+}
+
+// give the zeroed frames back to the buddy allocator; returns false if there were none
+static bool drain_zero_pools()
+{
+    bool drained = false;
+    for (auto& zp : zero_pools) {
+        drained |= zp.count > 0;
+        while (zp.count)
+            free_pfn(zp.frames[--zp.count]);
+    }
+    return drained;
+}
+
+// the number of page sizes in one way of the L2 cache (CPUID 80000006h)
+static void detect_colors()
+{
+    uint32_t max_ext, a, b, c, d;
+    asm volatile ("cpuid" : "=a"(max_ext), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000000));
+    if (max_ext < 0x80000006)
+        return;
+    asm volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000006));
+
+    // ECX[31:16] is the size in KiB, ECX[15:12] encodes the associativity
+    static const uint8_t ways[16] = {0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0};
+    const uint32_t size = (c >> 16) << 10, assoc = ways[(c >> 12) & 0xf];
+    if (!size || !assoc)
+        return; // disabled or fully associative, every frame has the same color
+
+    uint32_t colors = size / assoc / PAGE_SIZE;
+    while (num_colors * 2 <= min(colors, MAX_COLORS)) {
+        num_colors *= 2;
+        color_order++;
+    }
+}
+
+static inline color_pool* get_color_pool(uint32_t flags)
+{
+    if (flags & FRAME_DMA)
+        return nullptr;
+    if (flags & FRAME_KERNEL)
+        return &color_pools[0];
+    return (flags & FRAME_USER) ? &color_pools[1] : nullptr;
+}
+
+static inline void color_insert(color_pool& cp, pfn_t p)
+{
+    cp.lists[p & (num_colors - 1)].insert(page_entries + p);
+    cp.count++;
+}
+
+// take frames until there is one of the given color; returns false if there is none
+static bool refill_color(color_pool& cp, uint32_t color)
+{
+    // a block of num_colors frames has one frame of every color
+    pfn_t p = buddy_alloc(color_order, cp.flags, true);
+    if (p) {
+        split_frames(p);
+        for (uint32_t i = 0; i < num_colors; i++)
+            color_insert(cp, p + i);
+        return true;
+    }
+
+    // otherwise sort single frames into the lists, they may be scattered
+    for (uint32_t i = 0; i < num_colors; i++) {
+        p = buddy_alloc(0, cp.flags, true);
+        if (!p)
+            return false;
+        color_insert(cp, p);
+        if ((p & (num_colors - 1)) == color)
+            return true;
+    }
+    return false;
+}
+
+// give the frames in the color lists back to the buddy allocator; returns false if there were none
+static bool drain_color_pools()
+{
+    bool drained = false;
+    for (auto& cp : color_pools) {
+        drained |= cp.count > 0;
+        for (auto& l : cp.lists) {
+            while (l.next != &l) {
+                page_list_entry* entry = l.next;
+                entry->remove();
+                free_pfn(pfn_t(entry - page_entries));
+            }
+        }
+        cp.count = 0;
+    }
+    return drained;
+}
+
+pfn_t alloc_colored_pfn(uint32_t color, uint32_t flags)
+{
+    color_pool* cp = get_color_pool(flags);
+    if (!coloring_enabled || !cp || unlikely(!frames_start))
+        return alloc_pfn(0, flags);
+
+    color &= num_colors - 1;
+    page_list_entry& l = cp->lists[color];
+    if (l.next == &l && !refill_color(*cp, color)) {
+        cp->misses++;
+        return alloc_pfn(0, flags);
+    }
+
+    page_list_entry* entry = l.next;
+    entry->remove();
+    cp->count--;
+    cp->hits++;
+
+    const pfn_t p = pfn_t(entry - page_entries);
+    if (flags & FRAME_ZERO)
+        zero_frames(p, 0);
+    return p;
+}
+
+void set_page_coloring(bool on)
+{
+    coloring_enabled = on;
+    if (!on)
+        drain_color_pools();
+}
+
+bool page_coloring()
+{
+    return coloring_enabled;
+}
+
+uint32_t num_page_colors()
+{
+    return num_colors;
+}
+
+uint32_t first_color()
+{
+    // spread the first pages of the address spaces over the colors too
+    static uint32_t next = 0;
+    return next++;
+}
+
+// allocate 2**order continuous pages, return the first frame
+pfn_t alloc_pfn(uint8_t order, uint32_t flags)
+{
+    ASSERTH(order <= BUDDY_MAX_ORDER);
+
+    zero_pool* zp = nullptr;
+    if ((flags & FRAME_ZERO) && order == 0 && (zp = get_zero_pool(flags))) {
+        if (zp->count) {
+            zp->hits++;
+            return zp->frames[--zp->count];
+        }
+        zp->misses++;
+    }
+
+    pfn_t p = buddy_alloc(order, flags);
+    if (unlikely(!p) && (drain_zero_pools() | drain_color_pools()))
+        p = buddy_alloc(order, flags);
+    // there may be enough free frames, just not next to each other
+    if (unlikely(!p) && order > 0 && !(flags & FRAME_ATOMIC) && compact(order, flags))
+        p = buddy_alloc(order, flags);
+    if (unlikely(!p)) {
+        int n;
+        zones[get_zone_order(flags, n)[0]].num_failures++;
+        return 0;
+    }
+    if (flags & FRAME_ZERO)
+        zero_frames(p, order);
+    return p;
+}
+
+bool prezero_frame()
+{
+    if (unlikely(!frames_start))
+        return false;
+
+    for (auto& zp : zero_pools) {
+        if (zp.count >= zp.capacity)
+            continue;
+        // leave the pools alone when memory is getting low
+        pfn_t p = buddy_alloc(0, zp.flags, true);
+        if (!p)
+            return false;
+        zero_frames(p, 0);
+        zp.frames[zp.count++] = p;
+        return true;
+    }
+    return false;
+}
+
+// free the block starting at frame p
+uint32_t free_pfn(pfn_t p)
+{
+#ifdef _DEBUG_PAGING_
+    console::printf("PAGING/free_pfn called with frame %#X\n", p);
+#endif
+
+    ASSERTH(p < memory_frames);
+
+    uint32_t idx = p;
     page_list_entry* entry = page_entries + idx;
     ASSERTH(entry->order <= BUDDY_MAX_ORDER);
+    if (unlikely(p == zero_page))
+        return 0;
+    if (entry->shared) { // still mapped copy-on-write somewhere else
+        entry->shared--;
+        return 0;
+    }
+    entry->set_flag(page_list_entry::MOVABLE, false);
     uint8_t x = entry->order;
+    const uint32_t freed = 1<<x;
+    zone& z = zone_of(idx);
 
-    for (;x <= BUDDY_MAX_ORDER; x++) {
+    for (;x < BUDDY_MAX_ORDER; x++) {
         // do you have a buddy?
         uint32_t idx_buddy = get_buddy(idx, x);
         page_list_entry* buddy = page_entries + idx_buddy;
 
-        if (idx_buddy < (memory_size >> PAGE_SHIFT) && buddy->order == x &&
-            (*buddy_lists[x].map)[idx_buddy >> x]) { // the buddy is free. merge.
+        if (idx_buddy < z.end && buddy->is_free() && buddy->order == x) { // the buddy is free. merge.
             buddy->remove();
-            buddy_lists[x].map->clear(idx_buddy >> x);
-            buddy_lists[x].num_avail--;
+            buddy->set_flag(page_list_entry::FREE, false);
+            z.lists[x].num_avail--;
+            z.free -= 1<<x;
             if (idx_buddy < idx) {
                 idx = idx_buddy;
                 entry = buddy;
@@ -138,23 +579,400 @@ uint32_t free_frames(void* p)
         } else break;
     }
 
-    entry->order = min(x, BUDDY_MAX_ORDER);
-    buddy_lists[entry->order].nil.insert(entry);
-    buddy_lists[entry->order].map->set(idx >> entry->order);
-    buddy_lists[entry->order].num_avail++;
+    buddy_insert(z, min(x, BUDDY_MAX_ORDER), idx);
 
 #ifdef _DEBUG_PAGING_
-    console::printf("PAGING/free_frames: freed a block with order %d\n", entry->order);
+    console::printf("PAGING/free_pfn: freed a block with order %d\n", entry->order);
 #endif
 
-    return 1<<(entry->order);
+    return freed;
+}
+
+void share_pfn(pfn_t p)
+{
+    if (p == zero_page)
+        return; // the zero page is never freed
+    page_list_entry* entry = page_entries + p;
+    ASSERTH(entry->order == 0 && entry->shared < 0xffff);
+    entry->shared++;
+    entry->set_flag(page_list_entry::MOVABLE, false); // there is more than one page mapping it now
+}
+
+void split_frames(pfn_t p)
+{
+    page_list_entry* entry = page_entries + p;
+    ASSERTH(entry->order <= BUDDY_MAX_ORDER && !entry->shared);
+    // none of the frames in an allocated block is marked free, so only the
+    // orders have to change
+    const uint32_t n = 1 << entry->order;
+    for (uint32_t i = 0; i < n; i++) {
+        entry[i].order  = 0;
+        entry[i].shared = 0;
+        entry[i].set_flag(page_list_entry::MOVABLE, false);
+    }
+}
+
+void set_movable(pfn_t pfn, page* pg)
+{
+    // frames outside the buddy allocator, blocks and shared frames stay put
+    if (pfn == zero_page || pfn >= memory_frames)
+        return;
+    page_list_entry* entry = page_entries + pfn;
+    if (entry->order != 0 || entry->shared)
+        return;
+    entry->set_flag(page_list_entry::MOVABLE, true);
+    entry->rmap = pg;
+}
+
+/* compaction moves the movable frames out of one aligned block, so that the
+   block can be merged when they are freed. a frame is only moved if its
+   reverse mapping still points at it: frames being unmapped have already
+   lost their page entry, but are not freed until the TLB is flushed */
+
+// the largest block of the compaction target
+constexpr uint32_t COMPACT_MAX_FRAMES = 1 << BUDDY_MAX_ORDER;
+
+static pfn_t compact_old[COMPACT_MAX_FRAMES];   /* frames moved away */
+static pfn_t compact_held[COMPACT_MAX_FRAMES];  /* new frames inside the target */
+static uint16_t compact_cost[COMPACT_MAX_FRAMES >> 1]; /* frames to move per block, */
+constexpr uint16_t COMPACT_UNMOVABLE = 0xffff;          /* or this if one is stuck */
+
+// whether the allocated frame idx can be moved
+static inline bool frame_movable(pfn_t idx)
+{
+    const page_list_entry* entry = page_entries + idx;
+    return entry->is_movable() && entry->order == 0 && !entry->shared &&
+           entry->rmap->present && entry->rmap->addr == idx;
+}
+
+static inline bool block_free(pfn_t idx)
+{
+    return page_entries[idx].is_free();
+}
+
+// the aligned block of the given order in z that is cheapest to empty; 0 if there is none
+static pfn_t compact_target(zone& z, uint8_t order)
+{
+    const uint32_t blocks = COMPACT_MAX_FRAMES >> order;
+    pfn_t best = 0;
+    uint32_t best_cost = COMPACT_UNMOVABLE;
+
+    for (pfn_t base = z.start & ~(COMPACT_MAX_FRAMES - 1); base < z.end; base += COMPACT_MAX_FRAMES) {
+        for (uint32_t b = 0; b < blocks; b++)
+            compact_cost[b] = 0;
+
+        // walk the heads of the free and allocated blocks
+        for (pfn_t i = base; i < base + COMPACT_MAX_FRAMES; ) {
+            uint16_t& cost = compact_cost[(i - base) >> order];
+            const uint8_t o = (i < z.start || i >= z.end) ? 0xff : page_entries[i].order;
+            if (o > BUDDY_MAX_ORDER) {
+                cost = COMPACT_UNMOVABLE; // not managed by the buddy allocator
+                i++;
+            } else if (block_free(i)) {
+                i += 1 << o;
+            } else if (o > 0 || !frame_movable(i)) {
+                // a block larger than the target makes every block it covers unmovable
+                for (uint32_t b = (i - base) >> order; b <= (i + (1 << o) - 1 - base) >> order; b++)
+                    compact_cost[b] = COMPACT_UNMOVABLE;
+                i += 1 << o;
+            } else {
+                if (cost != COMPACT_UNMOVABLE)
+                    cost++;
+                i++;
+            }
+        }
+
+        for (uint32_t b = 0; b < blocks; b++) {
+            if (compact_cost[b] < best_cost) {
+                best_cost = compact_cost[b];
+                best = base + (b << order);
+            }
+        }
+    }
+
+    // a block that is already free only fails because of the watermarks
+    return best_cost > 0 ? best : 0;
+}
+
+// empty the block of the given order at target; returns false if we ran out of frames
+static bool compact_block(zone& z, pfn_t target, uint8_t order)
+{
+    const pfn_t target_end = target + (1 << order);
+    uint32_t nold = 0, nheld = 0;
+    bool ok = true;
+
+    for (pfn_t i = target; i < target_end && ok; ) {
+        const uint8_t o = page_entries[i].order;
+        if (block_free(i)) {
+            i += 1 << o;
+            continue;
+        }
+        ASSERTH(o == 0 && frame_movable(i));
+
+        // the new frame has to be outside of the target block
+        pfn_t frame = 0;
+        while ((ok = z.free > z.wmark_min) && (frame = zone_alloc(z, 0)) &&
+               frame >= target && frame < target_end)
+            compact_held[nheld++] = frame;
+        if (!ok || !frame) {
+            ok = false;
+            break;
+        }
+
+        page* pg = page_entries[i].rmap;
+        copy_frame(frame, i);
+        pg->addr = frame;
+        set_movable(frame, pg);
+        compact_old[nold++] = i;
+        i++;
+    }
+
+    // nobody may use the old frames before they are freed
+    if (nold)
+        flush_tlb();
+    for (uint32_t k = 0; k < nold; k++)
+        free_pfn(compact_old[k]);
+    for (uint32_t k = 0; k < nheld; k++)
+        free_pfn(compact_held[k]);
+    compact_migrated += nold;
+    return ok;
+}
+
+static bool compact_zone(zone& z, uint8_t order)
+{
+    // the frames are copied through kmap, and nothing may change between
+    // choosing the block and emptying it
+    const bool intr = get_eflags() & (1<<9); // IF
+    interrupt_disable();
+
+    bool ok = false;
+    const pfn_t target = compact_target(z, order);
+    if (target) {
+#ifdef _DEBUG_PAGING_
+        console::printf("PAGING/compact: emptying block of order %d at frame %#X in %s\n", order, target, z.name);
+#endif
+        compact_runs++;
+        ok = compact_block(z, target, order);
+        if (ok)
+            compact_success++;
+    }
+
+    if (intr)
+        interrupt_enable();
+    return ok;
+}
+
+bool compact(uint8_t order, uint32_t flags)
+{
+    ASSERTH(order <= BUDDY_MAX_ORDER);
+    if (unlikely(!frames_start) || order == 0)
+        return false;
+
+    int n;
+    const zone_type* order_list = get_zone_order(flags, n);
+    for (int i = 0; i < n; i++) {
+        zone& z = zones[order_list[i]];
+        // moving frames needs as many free ones as the block has
+        if (z.managed && z.free >= (1u << order) + z.wmark_min && compact_zone(z, order))
+            return true;
+    }
+    return false;
+}
+
+bool compact_idle()
+{
+    if (unlikely(!frames_start))
+        return false;
+
+    // free memory that is plentiful but scattered, in the zones large pages come from
+    static uint32_t last_failed[NUM_ZONES];
+    for (zone_type t : fallback_user) {
+        zone& z = zones[t];
+        if (!z.managed || z.free < (2u << LARGE_PAGE_ORDER) + z.wmark_low || z.free == last_failed[t])
+            continue;
+        bool fragmented = true;
+        for (int x = LARGE_PAGE_ORDER; x <= BUDDY_MAX_ORDER; x++)
+            fragmented &= z.lists[x].num_avail == 0;
+        if (!fragmented)
+            continue;
+        if (compact_zone(z, LARGE_PAGE_ORDER))
+            return true;
+        last_failed[t] = z.free; // don't try again until something changes
+    }
+    return false;
+}
+
+page_table* alloc_table(void** phys_addr)
+{
+    page_table* table;
+    if (unlikely(!frames_start)) {
+        // the buddy allocator is not set up yet, use the placement allocator
+        table = (page_table*) memory::kmalloc(sizeof(page_table), memory::KMALLOC_ALIGN | memory::KMALLOC_ZERO);
+    } else if (zero_pools[0].count || !table_cache_count) {
+        // prefer a frame that is already zeroed over the table cache
+        void* frame = alloc_frames(0, FRAME_KERNEL | FRAME_ZERO);
+        if (unlikely(!frame))
+            return nullptr;
+        table = (page_table*) phys_to_virt(frame);
+        table_cache_misses++;
+    } else {
+        table = table_cache[--table_cache_count];
+        memsetd(table, 0, sizeof(page_table) >> 2);
+        table_cache_hits++;
+    }
+
+    if (phys_addr)
+        *phys_addr = virt_to_phys(table);
+    return table;
+}
+
+void free_table(page_table* table)
+{
+    ASSERTH(uint32_t(table) >= frames_start); // tables from the placement allocator are never freed
+    if (table_cache_count < TABLE_CACHE_SIZE)
+        table_cache[table_cache_count++] = table;
+    else
+        free_frames(virt_to_phys(table));
+}
+
+static page_dir* alloc_page_dir()
+{
+    void* frame = alloc_kernel_frames(PAGE_DIR_ORDER);
+    if (unlikely(!frame))
+        return nullptr;
+    return (page_dir*) phys_to_virt(frame);
+}
+
+void free_page_dir(page_dir* dir)
+{
+    ASSERTH(uint32_t(dir) >= frames_start);
+    free_frames(dir->phys_addr());
 }
 
 void dump_paging_stats()
 {
     console::puts("Paging buddy allocator stats:\n");
-    for (int i=0;i<=BUDDY_MAX_ORDER;i++)
-        console::printf("\t%d:\t%d\n", i, buddy_lists[i].num_avail);
+    console::printf("  %d frame descriptors of %d bytes: %d KiB\n", memory_frames,
+                    sizeof(page_list_entry), (memory_frames * sizeof(page_list_entry)) >> 10);
+    for (const auto& z : zones) {
+        if (!z.managed)
+            continue;
+        console::printf("  %s: %d/%d frames free, watermarks %d/%d, %d allocs, %d fallbacks, %d failures\n",
+                        z.name, z.free, z.managed, z.wmark_min, z.wmark_low,
+                        z.num_allocs, z.num_fallbacks, z.num_failures);
+        for (int i=0;i<=BUDDY_MAX_ORDER;i++)
+            console::printf("\t%d:\t%d\n", i, z.lists[i].num_avail);
+    }
+    console::printf("Page table cache: %d cached, %d hits, %d misses\n",
+                    table_cache_count, table_cache_hits, table_cache_misses);
+    console::printf("Copy-on-write: %d pages shared, %d copied, %d reused\n",
+                    cow_shared, cow_copies, cow_reuses);
+    console::printf("Demand-zero: %d zero page mappings, %d frames allocated\n",
+                    lazy_zero_maps, lazy_allocs);
+    console::printf("Unmap batches: %d flushed (%d by invlpg, %d full flushes), %d pages\n",
+                    batch_flushes, batch_invlpgs, batch_full, batch_pages);
+    console::printf("Large pages: %d mapped, %d fallbacks, %d copied, %d split\n",
+                    large_maps, large_fallbacks, large_copies, large_splits);
+    console::printf("kmap: %d identity mapped, %d through slots\n",
+                    kmap_direct, kmap_slots);
+    console::printf("Compaction: %d blocks tried, %d freed, %d frames migrated\n",
+                    compact_runs, compact_success, compact_migrated);
+    console::printf("Page coloring: %s, %d colors\n", coloring_enabled ? "on" : "off", num_colors);
+    for (const auto& cp : color_pools)
+        console::printf("  %s frames: %d in color lists, %d hits, %d misses\n",
+                        (cp.flags & FRAME_KERNEL) ? "kernel" : "user", cp.count, cp.hits, cp.misses);
+    for (const auto& zp : zero_pools) {
+        const uint32_t total = zp.hits + zp.misses;
+        console::printf("Zeroed %s frames: %d/%d pooled, %d hits, %d misses (%d%% hit rate)\n",
+                        (zp.flags & FRAME_KERNEL) ? "kernel" : "user", zp.count, zp.capacity,
+                        zp.hits, zp.misses, total ? zp.hits * 100 / total : 0);
+    }
+}
+
+// a user frame; with page coloring, in the color order of the current address space
+static pfn_t alloc_user_pfn(uint32_t flags)
+{
+    const auto p = process::get_current_proc();
+    if (coloring_enabled && p && p->dir)
+        return alloc_colored_pfn(p->dir->next_color++, flags);
+    return alloc_pfn(0, flags);
+}
+
+// resolve a write fault on a copy-on-write page; returns false if addr is not one
+static bool handle_cow_fault(uint32_t addr)
+{
+    page* pg = cur_dir->get_page(addr >> PAGE_SHIFT);
+    if (!pg || !pg->present || !(pg->value & PAGE_COW))
+        return false;
+
+    const pfn_t frame = pg->addr;
+    page_list_entry* entry = page_entries + frame;
+    if (frame == zero_page) {
+        // first write to lazily allocated memory, there is nothing to copy
+        const pfn_t fresh = alloc_user_pfn(FRAME_USER | FRAME_ZERO);
+        if (unlikely(!fresh))
+            return false;
+        pg->addr = fresh;
+        set_movable(fresh, pg);
+        lazy_allocs++;
+    } else if (entry->shared) {
+        const pfn_t copy = alloc_user_pfn(FRAME_USER);
+        if (unlikely(!copy))
+            return false;
+        copy_frame(copy, frame);
+        entry->shared--;
+        pg->addr = copy;
+        set_movable(copy, pg);
+        cow_copies++;
+    } else {
+        set_movable(frame, pg);
+        cow_reuses++; // everybody else has already made their copy
+    }
+
+    pg->value = (pg->value & ~PAGE_COW) | PAGE_RW;
+    flush_tlb_entry((void*)addr);
+    return true;
+}
+
+bool fault_in(const void* addr, bool write)
+{
+    const uint32_t vaddr = uint32_t(addr);
+    const auto p = process::get_current_proc();
+    if (unlikely(!p || !p->dir) || vaddr >= KERNEL_VIRTUAL_BASE)
+        return false;
+    const vma* v = p->dir->vmas.find(vaddr);
+    if (!v || v->prot == PROT_NONE || (write && !(v->prot & PROT_WRITE)))
+        return false;
+    if (cur_dir->is_large(vaddr))
+        return true;
+
+    // writable memory covering the whole chunk gets a large page
+    const uint32_t chunk = vaddr & ~(LARGE_PAGE_SIZE - 1);
+    if ((v->prot & PROT_WRITE) && v->start <= chunk && v->end - chunk >= LARGE_PAGE_SIZE &&
+        !cur_dir->tables[page_dir::dir_index(chunk)] && !cur_dir->entries[page_dir::dir_index(chunk)].present) {
+        if (cur_dir->map_large(chunk, PAGE_PRESENT | PAGE_RW | PAGE_US | nx_flag(v->prot)))
+            return true;
+    }
+
+    page* pg = cur_dir->get_page(vaddr >> PAGE_SHIFT, true, PAGE_PRESENT | PAGE_RW | PAGE_US);
+    if (pg->present)
+        return true;
+
+    if (write) {
+        const pfn_t frame = alloc_user_pfn(FRAME_USER | FRAME_ZERO);
+        if (unlikely(!frame))
+            return false;
+        pg->value = (pte_t(frame) << PAGE_SHIFT) | PAGE_PRESENT | PAGE_RW | PAGE_US | nx_flag(v->prot);
+        set_movable(frame, pg);
+        lazy_allocs++;
+    } else {
+        // share the zero page until the first write
+        pg->value = (pte_t(zero_page) << PAGE_SHIFT) | PAGE_PRESENT | PAGE_US | nx_flag(v->prot) |
+                    ((v->prot & PROT_WRITE) ? PAGE_COW : 0);
+        lazy_zero_maps++;
+    }
+    flush_tlb_entry((void*)vaddr);
+    return true;
 }
 
 static void page_fault_handler(const isr::registers& regs)
@@ -168,6 +986,14 @@ static void page_fault_handler(const isr::registers& regs)
     const bool rsvd    = regs.err & 8;
     const bool id      = regs.err & 16;
 
+    if (!user && !present && heap::handle_fault((void*)faulting_addr))
+        return; // heap page released by heap::reclaim()
+    // the kernel writing to user memory faults as well, since CR0.WP is set
+    if (present && write && faulting_addr < KERNEL_VIRTUAL_BASE && handle_cow_fault(faulting_addr))
+        return;
+    if (!present && fault_in((void*)faulting_addr, write))
+        return; // demand-zero memory (brk and bss)
+
     console::puts("Page fault [");
     console::puts(present ? "PV " : "NP ");
     console::puts(write ? "W " : "R ");
@@ -193,24 +1019,31 @@ static void page_fault_handler(const isr::registers& regs)
 //////////////////////////////////////////////////////////////////////////
 // page_dir methods
 
+// mappings in the kernel half are the same in every directory, so they
+// are global and survive CR3 reloads
+static inline uint32_t global_flags(uint32_t pg_idx, uint32_t flags)
+{
+    return pg_idx >= (KERNEL_VIRTUAL_BASE >> PAGE_SHIFT) ? flags | PAGE_GLOBAL : flags;
+}
+
 page* page_dir::get_page(uint32_t addr, bool make_table, uint16_t flags) // addr = virtual_address >> PAGE_SHIFT
 {
-    uint32_t idx = addr >> 10; // table index
+    uint32_t idx = addr >> PAGE_TABLE_IN_PAGES_SHIFT; // table index
     if (tables[idx]) // the table exists
-        return &tables[idx]->pages[addr&1023];
-    else if (make_table) {
+        return &tables[idx]->pages[addr & (PAGE_TABLE_ENTRIES-1)];
+    else if (make_table && is_large(addr << PAGE_SHIFT)) {
+        split_large(addr << PAGE_SHIFT);
+        return &tables[idx]->pages[addr & (PAGE_TABLE_ENTRIES-1)];
+    } else if (make_table) {
         void* phys; // physical address of the table
 
-        tables[idx] = (page_table*)
-            memory::kmalloc(sizeof(page_table), memory::KMALLOC_ALIGN, &phys);
+        tables[idx] = alloc_table(&phys);
         ASSERT(tables[idx] != nullptr);
 
-        memsetd(tables[idx], 0, sizeof(page_table) >> 2);
-
         entries[idx].value = flags;
         entries[idx].addr  = uint32_t(phys) >> PAGE_SHIFT;
 
-        return &tables[idx]->pages[addr&1023];
+        return &tables[idx]->pages[addr & (PAGE_TABLE_ENTRIES-1)];
     }
     return nullptr;
 }
@@ -222,115 +1055,209 @@ bool page_dir::map_pages(uint32_t start, const void* addr, uint32_t sz,
          i++, addr = (void*)(uint32_t(addr) + PAGE_SIZE)) {
         page* p = get_page(i, make_table);
         if (!p) return false;
-        p->value = flags;
+        const bool was_present = p->present;
+        p->value = global_flags(i, flags);
         p->addr  = uint32_t(addr) >> PAGE_SHIFT;
+        if (was_present)
+            flush_tlb_entry((void*)(i << PAGE_SHIFT));
     }
     return true;
 }
 
 bool page_dir::alloc_pages(uint32_t start, uint32_t sz, uint16_t flags)
 {
+    constexpr uint32_t CHUNK_PAGES = PAGE_TABLE_ENTRIES;
     for (uint32_t i = start; i < start+sz; i++) {
+        const uint32_t vaddr = i << PAGE_SHIFT;
+        if ((flags & PAGE_US) && !(i & (CHUNK_PAGES - 1)) && start + sz - i >= CHUNK_PAGES) {
+            const uint32_t idx = i >> PAGE_TABLE_IN_PAGES_SHIFT;
+            if (is_large(vaddr)) {
+                entries[idx].value = (pte_t(entries[idx].addr) << PAGE_SHIFT) | PAGE_DIR_4M | flags |
+                                     (entries[idx].value & PAGE_NX);
+                flush_tlb_entry((void*)vaddr);
+                i += CHUNK_PAGES - 1;
+                continue;
+            }
+            if (!tables[idx] && !entries[idx].present && map_large(vaddr, flags)) {
+                i += CHUNK_PAGES - 1;
+                continue;
+            }
+        }
+        if (is_large(vaddr))
+            split_large(vaddr); // only partly covered
+
         page* p = get_page(i);
         if (p && p->present) {
             // if it is already present, just set the flags and move on
-            p->value = (p->addr << PAGE_SHIFT) | flags;
+            // (a copy-on-write page stays read-only until it is written to)
+            const uint32_t cow = p->value & PAGE_COW;
+            p->value = (pte_t(p->addr) << PAGE_SHIFT) | (p->value & PAGE_NX) |
+                       global_flags(i, cow ? (flags & ~PAGE_RW) | cow : flags);
+            flush_tlb_entry((void*)(i << PAGE_SHIFT));
             continue;
         }
 
         p = get_page(i, true, flags);
         if (!p) return false;
 
-        p->value = flags;
-        p->addr  = uint32_t(paging::alloc_frames()) >> PAGE_SHIFT;
-        if (!p->addr) return false;
+        // the page stays unmapped if there is no frame, so that the caller
+        // can unmap what was allocated so far
+        const pfn_t frame = (flags & PAGE_US) ? alloc_user_pfn(FRAME_USER | FRAME_ZERO) : alloc_pfn(0, FRAME_ZERO);
+        if (!frame) return false;
+        p->value = global_flags(i, flags);
+        p->addr  = frame;
+        if (flags & PAGE_US)
+            set_movable(frame, p);
     }
     return true;
 }
 
-// copy the contents contaning respective physical addresses
-// dst and src must be aligned at 4K boundaries
-// count is number of uint32_t's
-static void* memcpyd_phys_aligned(void* dst, const void* src, size_t count)
+page page_dir::lookup(const void* addr) const
 {
-#ifdef _DEBUG_PAGING_
-    console::printf("PAGING/memcpyd_phys_aligned: copy from %#X to %#X \n", uint32_t(src), uint32_t(dst));
-#endif
-    // we map 4KiB at a time
-
-    // use pages at the end
-    constexpr uint32_t dst_vaddr = 0xffffe000, src_vaddr = 0xfffff000;
-
-    // preserve old pages
-    page page_dst_old, page_src_old;
-    page_dst_old.value = page_src_old.value = 0;
-
-    page* page_dst = cur_dir->get_page(dst_vaddr >> PAGE_SHIFT);
-    page* page_src = cur_dir->get_page(src_vaddr >> PAGE_SHIFT);
-
-    if (page_dst)
-        page_dst_old.value = page_dst->value;
-    else
-        page_dst = cur_dir->get_page(dst_vaddr >> PAGE_SHIFT, true);
+    const uint32_t idx = dir_index(uint32_t(addr));
+    page pg;
+    pg.value = 0;
+    if (tables[idx])
+        return tables[idx]->pages[table_index(uint32_t(addr))];
+    if (entries[idx].present && entries[idx].ps) {
+        // the low flags of a large page mean the same as in a page
+        pg.value = entries[idx].value & (PAGE_PRESENT | PAGE_RW | PAGE_US | PAGE_WRITETHROUGH |
+                                         PAGE_NOCACHE | PAGE_ACCESSED | PAGE_DIRTY | PAGE_NX);
+        pg.addr  = entries[idx].addr + table_index(uint32_t(addr));
+    }
+    return pg;
+}
 
-    if (page_src)
-        page_src_old.value = page_src->value;
-    else
-        page_src = cur_dir->get_page(src_vaddr >> PAGE_SHIFT, true);
+bool page_dir::map_large(uint32_t vaddr, pte_t flags)
+{
+    const uint32_t idx = dir_index(vaddr);
+    ASSERTH(!(vaddr & (LARGE_PAGE_SIZE - 1)) && idx < KERNEL_HIGHMEM_START &&
+            !tables[idx] && !entries[idx].present);
+
+    const pfn_t block = alloc_pfn(LARGE_PAGE_ORDER, FRAME_USER | FRAME_ZERO);
+    if (!block) {
+        large_fallbacks++;
+        return false;
+    }
+    entries[idx].value = (pte_t(block) << PAGE_SHIFT) | PAGE_DIR_4M | flags;
+    large_maps++;
+    return true;
+}
 
-    void* ret = dst;
+void page_dir::split_large(uint32_t vaddr)
+{
+    const uint32_t idx = dir_index(vaddr);
+    ASSERTH(is_large(vaddr));
 
-    page_dst->value = page_src->value = PAGE_PRESENT | PAGE_RW;
+    void* phys;
+    page_table* table = alloc_table(&phys);
+    ASSERT(table != nullptr);
+
+    const pfn_t frame = entries[idx].addr;
+    const pte_t flags = lookup((void*)vaddr).value & ((PAGE_SIZE - 1) | PAGE_NX);
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
+        table->pages[i].value = (pte_t(frame + i) << PAGE_SHIFT) | flags;
+    split_frames(frame);
+
+    tables[idx] = table;
+    entries[idx].value = uint32_t(phys) | PAGE_PRESENT | PAGE_RW | PAGE_US;
+    // the translations stay the same, but the large TLB entry has to go
+    if (loaded())
+        flush_tlb_entry((void*)vaddr);
+    large_splits++;
+}
 
-    page_dst->addr = uint32_t(dst) >> PAGE_SHIFT;
-    page_src->addr = uint32_t(src) >> PAGE_SHIFT;
+void* kmap(pfn_t pfn)
+{
+    if (pfn < KERNEL_IDMAP_FRAMES) {
+        kmap_direct++;
+        return phys_to_virt((void*)(pfn << PAGE_SHIFT));
+    }
 
-    for (;count > 0; page_dst->addr++, page_src->addr++) {
-        flush_tlb_entry((void*)dst_vaddr);
-        flush_tlb_entry((void*)src_vaddr);
+    ASSERTH(kmap_top < KMAP_SLOTS);
+    kmap_slots++;
+    const uint32_t vaddr = KMAP_BASE + (kmap_top++ << PAGE_SHIFT);
+    // the slot was invalidated when it was released, so there is nothing to flush
+    kernel_page_dir.get_page((void*)vaddr)->value =
+        (pte_t(pfn) << PAGE_SHIFT) | PAGE_PRESENT | PAGE_RW;
+    return (void*)vaddr;
+}
 
-        auto c = min(count, PAGE_SIZE/4);
-        memcpyd((void*)dst_vaddr, (void*)src_vaddr, c);
-        count -= c;
-    }
+void kunmap(const void* vaddr)
+{
+    if (uint32_t(vaddr) < KMAP_BASE)
+        return; // in the identity map
 
-    // restore old pages
-    page_dst->value = page_dst_old.value;
-    page_src->value = page_src_old.value;
-    flush_tlb_entry((void*)dst_vaddr);
-    flush_tlb_entry((void*)src_vaddr);
+    ASSERTH(kmap_top > 0 && uint32_t(vaddr) == KMAP_BASE + ((kmap_top - 1) << PAGE_SHIFT));
+    kmap_top--;
+    kernel_page_dir.get_page(vaddr)->value = 0;
+    flush_tlb_entry((void*)vaddr);
+}
 
-    return ret;
+void copy_frame(pfn_t dst, pfn_t src)
+{
+    void* d = kmap(dst);
+    void* s = kmap(src);
+    memcpyd(d, s, PAGE_SIZE >> 2);
+    kunmap(s);
+    kunmap(d);
 }
 
-// start of highmem page table
-constexpr int KERNEL_HIGHMEM_START = uint32_t(KERNEL_VIRTUAL_BASE) >> 22;
+void zero_frame(pfn_t pfn)
+{
+    void* v = kmap(pfn);
+    memsetd(v, 0, PAGE_SIZE >> 2);
+    kunmap(v);
+}
 
 page_dir* page_dir::clone(uint32_t flags, int stack_table_bot, int stack_table_top)
 {
     void* phys;
 
-    auto dir = (page_dir*) memory::kmalloc(sizeof(page_dir), memory::KMALLOC_ALIGN, &phys);
+    auto dir = alloc_page_dir();
     ASSERTH(dir != nullptr);
     memsetd(dir->entries, 0, sizeof(dir->entries)/4);
     memsetd(dir->tables, 0, sizeof(dir->tables)/4);
-    if (uintptr_t(dir->entries) != uintptr_t(dir)) {
-        console::printf("dir->entries = %#X; dir = %#X\n", uintptr_t(dir->entries), uintptr_t(dir));
-    }
-    dir->phys_addr = (page_dir*) phys;
+
+#ifdef CONFIG_PAE
+    dir->init_pdpt();
+#endif
 
     // copy all page tables
-    for (int i = 0; i < 1024; i++) {
-        bool kstack = i >= int(uint32_t(KERNEL_STACK_BOT) >> 22) && i <= int(uint32_t(KERNEL_STACK_TOP) >> 22);
-        if (i >= KERNEL_HIGHMEM_START && !kstack) {
-            // highmem and not stack; map to kernel_page_dir
+    for (int i = 0; i < int(PAGE_DIR_ENTRIES); i++) {
+        if (i >= KERNEL_HIGHMEM_START) {
+            // highmem; map to kernel_page_dir
             dir->tables[i]  = kernel_page_dir.tables[i];
             dir->entries[i] = kernel_page_dir.entries[i];
             continue;
         }
+        if (entries[i].present && entries[i].ps && !tables[i]) {
+            // large pages
+            if (entries[i].value == kernel_page_dir.entries[i].value) {
+                dir->tables[i]  = kernel_page_dir.tables[i];
+                dir->entries[i] = kernel_page_dir.entries[i];
+                continue;
+            }
+            if (!(flags & CLONE_VM)) {
+                // copy it into a block of our own if there is one
+                const pfn_t block = alloc_pfn(LARGE_PAGE_ORDER);
+                if (block) {
+                    const pfn_t from = entries[i].addr;
+                    for (uint32_t j = 0; j < PAGE_TABLE_ENTRIES; j++)
+                        copy_frame(block + j, from + j);
+                    dir->entries[i].value = (entries[i].value & ((PAGE_SIZE - 1) | PAGE_NX)) |
+                                            (pte_t(block) << PAGE_SHIFT);
+                    large_copies++;
+                    continue;
+                }
+            }
+            // share it through a page table instead, so that both directories
+            // see it the same way (CLONE_VM) or it can be copy-on-write
+            split_large(uint32_t(i) << PAGE_TABLE_SHIFT);
+        }
         if (tables[i]) {
             // 4 KiB pages
-            if ((flags & CLONE_VM) && !kstack &&
+            if ((flags & CLONE_VM) &&
                 !(stack_table_bot <= i && i <= stack_table_top)) {
                 // if the the flags require we don't copy,
                 // and if the current table is not part of the stack,
@@ -338,65 +1265,87 @@ page_dir* page_dir::clone(uint32_t flags, int stack_table_bot, int stack_table_t
                 dir->tables[i]  = tables[i];
                 dir->entries[i] = entries[i];
             } else {
-                // clone this table
-                dir->tables[i] = tables[i]->clone(&phys);
+                // clone this table; user pages are shared copy-on-write
+                dir->tables[i] = tables[i]->clone(&phys, true);
                 dir->entries[i].value = entries[i].value;
                 dir->entries[i].addr  = uint32_t(phys) >> PAGE_SHIFT;
             }
-        } else if (entries[i].present && entries[i].ps) {
-            // 4 MiB pages
-            if (entries[i].value == kernel_page_dir.entries[i].value) {
-                dir->tables[i]  = kernel_page_dir.tables[i];
-                dir->entries[i] = kernel_page_dir.entries[i];
-            } else {
-                // copy data
-                // FIXME not implemented
-                PANIC("PAGING/clone: Copying 4 MiB pages not implemented");
-            }
         }
     }
 
+    // drop the writable TLB entries of the pages we have just shared
+    if (this == cur_dir)
+        switch_page_dir(this);
+
     return dir;
 }
 
+shared_page_dir::~shared_page_dir()
+{
+    if (likely(dir)) {
+        // don't free the directory under a kernel-only context still using it
+        if (dir->loaded())
+            switch_page_dir(&kernel_page_dir);
+        // free everything except cloned_dir
+        dir->free_tables(cloned_dir ? cloned_dir->dir : nullptr);
+        free_page_dir(dir);
+        dir = nullptr;
+    }
+}
+
 void page_dir::free_tables(const page_dir* shared_vm_dir)
 {
     if (!shared_vm_dir)
         shared_vm_dir = &kernel_page_dir;
 
     // free everything EXCEPT highmem && shared_vm
-    for (int i = 0; i < 1024; i++)
-        if (tables[i] && tables[i] != shared_vm_dir->tables[i]
-            && !(i >= int(uint32_t(KERNEL_STACK_BOT) >> 22) && i <= int(uint32_t(KERNEL_STACK_TOP) >> 22))) {
+    for (int i = 0; i < int(PAGE_DIR_ENTRIES); i++)
+        if (tables[i] && tables[i] != shared_vm_dir->tables[i]) {
             tables[i]->free();
-            delete tables[i];
+            free_table(tables[i]);
             entries[i].value = 0;
             tables[i] = nullptr;
+        } else if (is_large(uint32_t(i) << PAGE_TABLE_SHIFT) &&
+                   entries[i].value != shared_vm_dir->entries[i].value) {
+            free_pfn(entries[i].addr);
+            entries[i].value = 0;
         }
 }
 
 
 
-page_table* page_table::clone(void** phys_addr)
+page_table* page_table::clone(void** phys_addr, bool cow)
 {
 #ifdef _DEBUG_PAGING_
     console::printf("cloning page_table...\n");
 #endif
 
-    auto table = (page_table*) memory::kmalloc(sizeof(page_table), memory::KMALLOC_ALIGN, phys_addr);
+    auto table = alloc_table(phys_addr);
     ASSERTH(table != nullptr);
-    memset(table, 0, sizeof(page_table));
 
     // copy all pages
-    for (int i = 0; i < 1024; i++) {
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
         if (pages[i].present) {
+            if (cow && pages[i].user) {
+                // writable pages become read-only in both tables until
+                // written to; read-only ones can simply be shared
+                if (pages[i].rw)
+                    pages[i].value = (pages[i].value & ~PAGE_RW) | PAGE_COW;
+                table->pages[i] = pages[i];
+                share_pfn(pages[i].addr);
+                cow_shared++;
+                continue;
+            }
+
             table->pages[i] = pages[i];
 
-            void* frame_addr = paging::alloc_frames();
-            ASSERTH(frame_addr != nullptr);
+            const pfn_t frame = alloc_pfn();
+            ASSERTH(frame != 0);
 
-            table->pages[i].addr = uint32_t(frame_addr) >> PAGE_SHIFT;
-            memcpyd_phys_aligned(frame_addr, (void*)(pages[i].addr << PAGE_SHIFT), PAGE_SIZE/4);
+            table->pages[i].addr = frame;
+            copy_frame(frame, pages[i].addr);
+            if (table->pages[i].user)
+                set_movable(frame, table->pages + i);
         }
     }
 
@@ -407,46 +1356,194 @@ page_table* page_table::clone(void** phys_addr)
     return table;
 }
 
+void unmap_batch::add(uint32_t vaddr, pfn_t frame)
+{
+    if (count == BATCH_SIZE)
+        flush();
+    vaddrs[count] = vaddr;
+    frames[count] = frame;
+    count++;
+}
+
+void unmap_batch::unmap(uint32_t vaddr)
+{
+    if (dir->is_large(vaddr))
+        dir->split_large(vaddr);
+    else if (vaddr >= KERNEL_VIRTUAL_BASE && is_kernel_large(vaddr))
+        split_kernel_large(vaddr);
+    page* pg = dir->get_page((void*)vaddr);
+    if (!pg || !pg->present)
+        return;
+    const pfn_t frame = pg->addr;
+    pg->value = 0;
+    add(vaddr & ~(PAGE_SIZE - 1), frame);
+}
+
+void unmap_batch::unmap_range(uint32_t start, uint32_t end)
+{
+    for (uint32_t a = start; a < end; ) {
+        const bool large = dir->is_large(a) || (a >= KERNEL_VIRTUAL_BASE && is_kernel_large(a));
+        if (large && !(a & (LARGE_PAGE_SIZE - 1)) && end - a >= LARGE_PAGE_SIZE) {
+            // the whole large page goes at once
+            const uint32_t idx = page_dir::dir_index(a);
+            const page_dir* owner = a < KERNEL_VIRTUAL_BASE ? dir : &kernel_page_dir;
+            const pfn_t block = owner->entries[idx].addr;
+            if (a < KERNEL_VIRTUAL_BASE)
+                dir->entries[idx].value = 0;
+            else {
+                memsetd(kernel_page_dir.tables[idx], 0, sizeof(page_table) >> 2);
+                set_kernel_entry(idx, uint32_t(virt_to_phys(kernel_page_dir.tables[idx])) | PAGE_PRESENT | PAGE_RW);
+            }
+            add(a, block);
+            a += LARGE_PAGE_SIZE;
+            if (!a) break;
+            continue;
+        }
+        if (!dir->tables[page_dir::dir_index(a)] && !dir->is_large(a)) {
+            a = (a & ~(LARGE_PAGE_SIZE - 1)) + LARGE_PAGE_SIZE;
+            if (!a) break; // wrapped around
+            continue;
+        }
+        unmap(a);
+        a += PAGE_SIZE;
+    }
+}
+
+void unmap_batch::invalidate(uint32_t vaddr)
+{
+    add(vaddr & ~(PAGE_SIZE - 1), 0);
+}
+
+void unmap_batch::flush()
+{
+    if (!count)
+        return;
+
+    // user mappings of a directory that isn't loaded can't be in the TLB;
+    // kernel ones are global and shared by every directory
+    bool user = false, kernel = false;
+    for (int i = 0; i < count; i++) {
+        if (vaddrs[i] >= KERNEL_VIRTUAL_BASE)
+            kernel = true;
+        else
+            user = true;
+    }
+    if (user && !dir->loaded())
+        user = false;
+
+    if (user || kernel) {
+        if (count <= INVLPG_MAX) {
+            for (int i = 0; i < count; i++)
+                if (vaddrs[i] >= KERNEL_VIRTUAL_BASE || user)
+                    flush_tlb_entry((void*)vaddrs[i]);
+            batch_invlpgs++;
+        } else {
+            if (kernel)
+                flush_tlb_global();
+            else
+                flush_tlb();
+            batch_full++;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+        if (frames[i])
+            free_pfn(frames[i]);
+
+    batch_flushes++;
+    batch_pages += count;
+    count = 0;
+}
+
 void page_table::free()
 {
-    for (int i=0; i<1024; i++)
+    for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++)
         if (pages[i].present)
-            paging::free_frames((void*)(uint32_t(pages[i].addr) << PAGE_SHIFT));
+            free_pfn(pages[i].addr);
+}
+
+#ifdef CONFIG_PAE
+void page_dir::init_pdpt()
+{
+    // PDPTEs only have the present bit, the permissions are in the directories
+    const uint32_t phys = uint32_t(virt_to_phys(entries));
+    for (uint32_t k = 0; k < 4; k++)
+        pdpt[k] = (phys + k * PAGE_SIZE) | PAGE_PRESENT;
+}
+#endif
+
+pte_t nx_flag(uint32_t prot)
+{
+    return (nx_enabled && !(prot & PROT_EXEC)) ? PAGE_NX : 0;
 }
 
-void init(uint32_t mem_sz)
+void init(pfn_t frames, const phys_range* ranges, int num_ranges)
 {
-    memory_size = mem_sz;
+    memory_frames = frames;
 
     isr::register_int_handler((uint8_t)isr::ISR_CODE::PAGE_FAULT, page_fault_handler);
 
-    mem_sz >>= PAGE_SHIFT;
+    // map the entire kernel to 0xC0000000, plus 4MiB of space for allocations before heap activates.
+    // boot.s only maps the first 4MiB, and the frame descriptors below can be much larger
+    for (size_t i = KERNEL_VIRTUAL_BASE; i < heap::HEAP_BASE; i += LARGE_PAGE_SIZE) {
+        const uint32_t idx = page_dir::dir_index(i);
+        kernel_page_dir.entries[idx].present = true;
+        kernel_page_dir.entries[idx].rw      = true;
+        kernel_page_dir.entries[idx].ps      = true;
+        kernel_page_dir.entries[idx].user    = false;
+        kernel_page_dir.entries[idx].addr    = (i - KERNEL_VIRTUAL_BASE) >> PAGE_SHIFT;
+        kernel_page_dir.entries[idx].value  |= PAGE_GLOBAL; // G bit of a large page
+    }
+    switch_page_dir(&kernel_page_dir);
+
+    // enable global pages (CR4.PGE); setting it also flushes the whole TLB
+    uint32_t cr4;
+    asm volatile ("mov %0, cr4" : "=r"(cr4));
+    asm volatile ("mov cr4, %0" :: "r"(cr4 | (1<<7)) : "memory");
 
-    page_entries = new page_list_entry[mem_sz]; // allocate list entries
+    page_entries = new page_list_entry[frames]; // allocate list entries
     ASSERT(page_entries != nullptr);
 
-    for (int i=0;i<=BUDDY_MAX_ORDER;i++) {
-        buddy_lists[i].nil.next  = &buddy_lists[i].nil;
-        buddy_lists[i].nil.prev  = &buddy_lists[i].nil;
-        buddy_lists[i].map = new bitmap(mem_sz >> i);
-        buddy_lists[i].num_avail = 0;
+    static const char* const zone_names[NUM_ZONES] = {"DMA", "Normal", "HighMem", "PAE"};
+    const pfn_t zone_ends[NUM_ZONES] = {ZONE_DMA_END >> PAGE_SHIFT, KERNEL_IDMAP_FRAMES,
+                                        ZONE_PAE_START, frames};
+    for (int t = 0; t < NUM_ZONES; t++) {
+        zone& z = zones[t];
+        z.name  = zone_names[t];
+        z.start = t ? zones[t-1].end : 0;
+        z.end   = min(zone_ends[t], frames);
+        if (z.end < z.start) z.end = z.start;
+        for (pfn_t i = z.start; i < z.end; i++)
+            page_entries[i].flags = t << page_list_entry::ZONE_SHIFT;
+        for (auto& l : z.lists) {
+            l.nil.next = l.nil.prev = &l.nil;
+            l.num_avail = 0;
+        }
     }
-
-    // map the entire kernel to 0xC0000000, plus 4MiB of space for allocations before heap activates
-    for (size_t i = KERNEL_VIRTUAL_BASE; i < heap::HEAP_BASE; i += (1<<22)) {
-        kernel_page_dir.entries[i>>22].present = true;
-        kernel_page_dir.entries[i>>22].rw      = true;
-        kernel_page_dir.entries[i>>22].ps      = true;
-        kernel_page_dir.entries[i>>22].user    = false;
-        kernel_page_dir.entries[i>>22].addr    = (i - KERNEL_VIRTUAL_BASE) >> PAGE_SHIFT;
+    for (auto& cp : color_pools)
+        for (auto& l : cp.lists)
+            l.next = l.prev = &l;
+    detect_colors();
+
+#ifdef CONFIG_PAE
+    // no-execute pages, if CPUID.80000001h:EDX.NX is set (EFER.NXE enables them)
+    uint32_t max_ext, a, b, c, d;
+    asm volatile ("cpuid" : "=a"(max_ext), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000000));
+    if (max_ext >= 0x80000001) {
+        asm volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0x80000001));
+        if (d & (1<<20)) {
+            asm volatile ("rdmsr" : "=a"(a), "=d"(d) : "c"(0xC0000080));
+            asm volatile ("wrmsr" :: "a"(a | (1<<11)), "d"(d), "c"(0xC0000080));
+            nx_enabled = true;
+        }
     }
-    switch_page_dir(&kernel_page_dir);
+#endif
 
 
     // allocate kernel heap & remap tables
     for (size_t i=heap::HEAP_BASE;
          i >= heap::HEAP_BASE && /* check for integer overflow */
-         i < memory::REMAP_END; i+=(1<<22)) {
+         i < memory::REMAP_END; i += LARGE_PAGE_SIZE) {
         kernel_page_dir.get_page((void*)i, true);
     }
 
@@ -455,15 +1552,30 @@ void init(uint32_t mem_sz)
     console::printf("PAGING/init: placement addr end = %#08X\n", end);
 #endif
 
-    // make blocks
-    for (size_t i = (end - KERNEL_VIRTUAL_BASE)>>PAGE_SHIFT, x = BUDDY_MAX_ORDER; i < mem_sz; i+=(1<<x)) {
-        for (; i+(1<<x) > mem_sz; x--) ; // decrease order as necessary
-        auto entry = page_entries + i;
-        entry->order = x;
-        buddy_lists[x].nil.insert(entry);
-        buddy_lists[x].map->set(i>>x);
-        buddy_lists[x].num_avail++;
+    // make blocks out of the usable ranges, skipping everything the kernel
+    // and the placement allocator have used
+    const pfn_t first = (end - KERNEL_VIRTUAL_BASE) >> PAGE_SHIFT;
+    for (int r = 0; r < num_ranges; r++) {
+        const pfn_t range_end = min(ranges[r].end, frames);
+        for (pfn_t i = max(ranges[r].start, first); i < range_end; ) {
+            // the largest block that is aligned at i and fits in the range
+            uint8_t x = BUDDY_MAX_ORDER;
+            while (x && ((i & ((1u << x) - 1)) || i + (1u << x) > range_end))
+                x--;
+            buddy_insert(zone_of(i), x, i);
+            i += 1u << x;
+        }
     }
+    frames_start = end;
+
+    for (auto& z : zones) {
+        z.managed = z.free;
+        z.wmark_min = z.managed ? max(z.managed / 256, 8u) : 0;
+        z.wmark_low = z.wmark_min * 2;
+    }
+
+    zero_page = alloc_pfn(0, FRAME_KERNEL | FRAME_ZERO);
+    ASSERT(zero_page != 0);
 
     // clone the kerenl page directory, so that it stays constant and we can compare
     // the entries of other directories with kernel_page_dir to decide which pages to link
@@ -0,0 +1,214 @@
+/* Atomic allocation pools.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <pool.h>
+#include <slab.h>
+#include <console.h>
+#include <lib/klib.h>
+
+//#define _DEBUG_POOL_
+
+/* interrupt handlers may run in the middle of heap or slab list surgery, so
+   allocations made from them are served from per-size stacks of reserved
+   slab objects instead. the stacks are lock-free (a tagged pointer swapped
+   with cmpxchg8b, the tag guarding against ABA when an interrupt pops and
+   pushes between the load and the swap of an interrupted pop); only refill()
+   talks to the slab caches behind them, and it runs in process context */
+
+namespace pool
+{
+
+volatile bool refill_pending = false;
+
+struct free_obj
+{
+    free_obj* next;
+};
+
+union stack_head
+{
+    struct
+    {
+        free_obj* top;
+        uint32_t  tag;          /* bumped on every update */
+    } s;
+    uint64_t raw;
+};
+
+struct pool_desc
+{
+    size_t   size;
+    int32_t  low;               /* ask for a refill below this */
+    int32_t  high;              /* refill up to this, trim down to this */
+
+    slab::cache* cache = nullptr;
+
+    alignas(8) volatile uint64_t head = 0;
+    volatile int32_t count = 0;    /* objects on the stack (may lag behind head) */
+
+    /* statistics */
+    volatile uint32_t num_allocs = 0;
+    volatile uint32_t num_frees = 0;
+    volatile uint32_t num_misses = 0;
+    uint32_t num_refilled = 0;
+    uint32_t num_trimmed = 0;
+};
+
+static pool_desc pools[] = {
+    {  32, 16, 64 },
+    {  64, 16, 64 },
+    { 128,  8, 32 },
+    { 256,  8, 32 },
+    { 512,  4, 16 },
+    {1024,  4, 16 },
+    {2048,  2,  8 },
+};
+
+constexpr size_t NUM_POOLS = sizeof(pools) / sizeof(pools[0]);
+
+static_assert(MAX_SIZE == 2048, "update pools");
+
+static char names[NUM_POOLS][16];
+
+static void push(pool_desc& p, void* obj)
+{
+    auto o = (free_obj*) obj;
+    stack_head old, n;
+    do {
+        old.raw = p.head;
+        o->next = old.s.top;
+        n.s.top = o;
+        n.s.tag = old.s.tag + 1;
+    } while (!__sync_bool_compare_and_swap(&p.head, old.raw, n.raw));
+    __sync_fetch_and_add(&p.count, 1);
+}
+
+static void* pop(pool_desc& p)
+{
+    stack_head old, n;
+    do {
+        // a torn read can't succeed in the swap, and top->next is always
+        // readable since slab objects live in the identity map
+        old.raw = p.head;
+        if (!old.s.top)
+            return nullptr;
+        n.s.top = old.s.top->next;
+        n.s.tag = old.s.tag + 1;
+    } while (!__sync_bool_compare_and_swap(&p.head, old.raw, n.raw));
+    __sync_fetch_and_sub(&p.count, 1);
+    return old.s.top;
+}
+
+static inline pool_desc* find_pool(const slab::cache* c)
+{
+    for (auto& p : pools)
+        if (p.cache == c)
+            return &p;
+    return nullptr;
+}
+
+void* alloc(size_t sz)
+{
+    if (unlikely(sz > MAX_SIZE))
+        return nullptr;
+
+    // try the larger pools before giving up
+    for (auto& p : pools) {
+        if (p.size < sz)
+            continue;
+        void* obj = pop(p);
+        if (likely(obj)) {
+            __sync_fetch_and_add(&p.num_allocs, 1);
+            if (p.count < p.low)
+                refill_pending = true;
+            return obj;
+        }
+        __sync_fetch_and_add(&p.num_misses, 1);
+        refill_pending = true;
+    }
+
+#ifdef _DEBUG_POOL_
+    console::printf("POOL: atomic allocation of %d bytes failed\n", sz);
+#endif
+    return nullptr;
+}
+
+bool owns(const void* p)
+{
+    return slab::owns(p) && find_pool(slab::get_cache(p));
+}
+
+void free(void* obj)
+{
+    pool_desc* p = find_pool(slab::get_cache(obj));
+    ASSERTH(p != nullptr);
+    push(*p, obj);
+    __sync_fetch_and_add(&p->num_frees, 1);
+    if (p->count > 2*p->high)
+        refill_pending = true;
+}
+
+void refill()
+{
+    static bool refilling = false;
+    if (refilling)
+        return;
+    refilling = true;
+    refill_pending = false;
+
+    for (auto& p : pools) {
+        if (unlikely(!p.cache))
+            continue;
+        while (p.count < p.high) {
+            void* obj = p.cache->alloc();
+            if (unlikely(!obj))
+                break;
+            push(p, obj);
+            p.num_refilled++;
+        }
+        while (p.count > p.high) {
+            void* obj = pop(p);
+            if (unlikely(!obj))
+                break;
+            p.cache->free(obj);
+            p.num_trimmed++;
+        }
+    }
+
+    refilling = false;
+}
+
+void dump_stats()
+{
+    console::puts("Atomic pool stats:\n");
+    console::puts("\tsize  low  high  count  allocs   frees  misses  refilled  trimmed\n");
+    for (auto& p : pools)
+        console::printf("\t%4d  %3d  %4d  %5d  %6d  %6d  %6d  %8d  %7d\n", p.size, p.low, p.high,
+                        p.count, p.num_allocs, p.num_frees, p.num_misses,
+                        p.num_refilled, p.num_trimmed);
+}
+
+void init()
+{
+    for (size_t i = 0; i < NUM_POOLS; i++) {
+        auto& p = pools[i];
+        console::snprintf(names[i], sizeof(names[i]), "pool-%d", p.size);
+        p.cache = new slab::cache(names[i], p.size, p.size < 64 ? p.size : 64);
+    }
+    refill();
+}
+
+}
@@ -1 +1 @@
-OBJS += mem/memory.o mem/paging.o mem/heap.o
+OBJS += mem/memory.o mem/paging.o mem/heap.o mem/slab.o mem/scratch.o mem/pool.o mem/vma.o mem/vmalloc.o mem/dma.o
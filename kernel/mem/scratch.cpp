@@ -0,0 +1,71 @@
+/* Per-process scratch arena.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <scratch.h>
+#include <memory.h>
+#include <paging.h>
+#include <proc.h>
+#include <lib/klib.h>
+
+namespace scratch
+{
+
+static inline arena* get_arena()
+{
+    auto p = process::get_current_proc();
+    if (unlikely(!p || !p->kstack))
+        return nullptr;
+    return (arena*) p->kstack;
+}
+
+scope::scope() : a(get_arena())
+{
+    saved = a ? a->used : 0;
+}
+
+scope::~scope()
+{
+    if (a)
+        a->used = saved;
+    while (fallbacks) {
+        auto next = fallbacks->next;
+        memory::kfree(fallbacks);
+        fallbacks = next;
+    }
+}
+
+void* scope::alloc(size_t sz, size_t align)
+{
+    if (likely(a)) {
+        const uint32_t start = (a->used + align - 1) & ~(align - 1);
+        if (start + sz <= SCRATCH_SIZE) {
+            a->used = start + sz;
+            return (void*) (uint32_t(a) + start);
+        }
+    }
+
+    // no arena or out of space; pad the block so that it can be aligned
+    auto b = (fallback_block*) memory::kmalloc(
+        sizeof(fallback_block) + sz + (align > sizeof(uintptr_t) ? align : 0));
+    if (unlikely(!b))
+        return nullptr;
+    b->next = fallbacks;
+    fallbacks = b;
+    const uint32_t p = uint32_t(b) + sizeof(fallback_block);
+    return (void*) ((p + align - 1) & ~(align - 1));
+}
+
+}
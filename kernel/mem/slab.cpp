@@ -0,0 +1,259 @@
+/* Kernel slab allocator.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <slab.h>
+#include <memory.h>
+#include <paging.h>
+#include <heap.h>
+#include <console.h>
+#include <lib/klib.h>
+#include <lib/string.h>
+#include <algorithm>
+
+using std::max;
+using paging::PAGE_SIZE;
+
+//#define _DEBUG_SLAB_
+
+/* each slab is one page taken from the identity mapped part of the buddy
+   allocator, so the slab header of an object is found by rounding its address
+   down to the page boundary, and freeing does not need any boundary tags */
+
+namespace slab
+{
+
+static bool online = false;
+static uint32_t slab_start = 0; // lowest address that can belong to a slab
+
+static cache* caches = nullptr;
+
+static inline size_t align_up(size_t x, size_t align)
+{
+    return (x + align - 1) & ~(align - 1);
+}
+
+static inline slab_header* get_slab(const void* p)
+{
+    return (slab_header*) (uint32_t(p) & ~(PAGE_SIZE - 1));
+}
+
+static inline void*& free_link(void* obj, size_t offset)
+{
+    return *(void**) (uint32_t(obj) + offset);
+}
+
+cache::cache(const char* name, size_t size, size_t align, ctor_t ctor)
+    : name(name), size(size), ctor(ctor)
+{
+    if (align < sizeof(void*)) align = sizeof(void*);
+    ASSERTH((align & (align - 1)) == 0);
+
+    // objects with a constructor have to keep their state while free,
+    // so the free list pointer is placed after the object instead
+    link_offset  = ctor ? align_up(size, sizeof(void*)) : 0;
+    stride       = align_up(ctor ? link_offset + sizeof(void*) : max(size, sizeof(void*)), align);
+    first_offset = align_up(sizeof(slab_header), align);
+    ASSERTH(first_offset + stride <= PAGE_SIZE);
+    objs_per_slab = (PAGE_SIZE - first_offset) / stride;
+
+    slab_header* const lists[] = {&partial, &full, &empty};
+    for (auto l : lists) {
+        l->magic = SLAB_MAGIC;
+        l->owner = this;
+        l->prev = l->next = l;
+    }
+
+    next_cache = caches;
+    caches = this;
+}
+
+// make a new slab
+slab_header* cache::grow()
+{
+    void* frame = paging::alloc_kernel_frames(0);
+    if (unlikely(!frame))
+        return nullptr;
+
+    auto s = (slab_header*) paging::phys_to_virt(frame);
+    s->magic = SLAB_MAGIC;
+    s->owner = this;
+    s->inuse = 0;
+    s->free_list = nullptr;
+
+    // build the free list backwards, so that objects are handed out in address order
+    for (int i = int(objs_per_slab) - 1; i >= 0; i--) {
+        void* obj = (void*) (uint32_t(s) + first_offset + i*stride);
+        if (ctor) ctor(obj);
+        free_link(obj, link_offset) = s->free_list;
+        s->free_list = obj;
+    }
+
+    num_slabs++;
+#ifdef _DEBUG_SLAB_
+    console::printf("SLAB/%s: new slab at %#X\n", name, uint32_t(s));
+#endif
+    return s;
+}
+
+// give the slab back to the frame allocator
+void cache::release(slab_header* s)
+{
+    ASSERTH(s->inuse == 0);
+    s->magic = 0;
+    paging::free_frames(paging::virt_to_phys(s));
+    num_slabs--;
+#ifdef _DEBUG_SLAB_
+    console::printf("SLAB/%s: released slab at %#X\n", name, uint32_t(s));
+#endif
+}
+
+void* cache::alloc()
+{
+    if (unlikely(!online))
+        return memory::kmalloc(size); // too early, use the placement allocator
+
+    slab_header* s = partial.next;
+    if (s == &partial) {
+        s = empty.next;
+        if (s != &empty)
+            s->remove();
+        else if (unlikely(!(s = grow())))
+            return nullptr;
+        partial.insert(s);
+    }
+
+    void* obj = s->free_list;
+    s->free_list = free_link(obj, link_offset);
+    if (++s->inuse == objs_per_slab) {
+        s->remove();
+        full.insert(s);
+    }
+
+    num_active++;
+    num_allocs++;
+    return obj;
+}
+
+void cache::free(void* p)
+{
+    slab_header* s = get_slab(p);
+    ASSERTH(s->owner == this);
+
+    free_link(p, link_offset) = s->free_list;
+    s->free_list = p;
+
+    if (s->inuse-- == objs_per_slab) { // was full
+        s->remove();
+        partial.insert(s);
+    }
+    if (s->inuse == 0) {
+        s->remove();
+        // keep one empty slab around, so that an alloc/free pair at the
+        // boundary does not hit the frame allocator every time
+        if (empty.empty_list())
+            empty.insert(s);
+        else
+            release(s);
+    }
+
+    num_active--;
+}
+
+void cache::shrink()
+{
+    while (!empty.empty_list()) {
+        slab_header* s = empty.next;
+        s->remove();
+        release(s);
+    }
+}
+
+bool is_online()
+{
+    return online;
+}
+
+bool owns(const void* p)
+{
+    return online && uint32_t(p) >= slab_start && uint32_t(p) < heap::HEAP_BASE;
+}
+
+cache* get_cache(const void* p)
+{
+    return get_slab(p)->owner;
+}
+
+size_t object_size(const void* p)
+{
+    return get_slab(p)->owner->get_size();
+}
+
+void free_object(void* p)
+{
+    if (unlikely(!p)) return;
+    slab_header* s = get_slab(p);
+    if (unlikely(s->magic != SLAB_MAGIC || !s->owner)) {
+        console::printf("p = %#X, slab = %#X, magic = %#X\n", uint32_t(p), uint32_t(s), s->magic);
+        PANIC("Freeing an invalid slab object");
+    }
+    s->owner->free(p);
+}
+
+static bool starts_with(const char* s, const char* prefix)
+{
+    while (*prefix)
+        if (*s++ != *prefix++)
+            return false;
+    return true;
+}
+
+const char* ctl_cache_name(char* buf, const char* pretty)
+{
+    // "... [with T = ...; Owner = name]"
+    const char* owner = nullptr;
+    for (const char* s = pretty; *s; s++)
+        if (starts_with(s, "Owner = "))
+            owner = s + 8;
+    if (!owner)
+        return "shared_ptr_ctl";
+
+    strcpy(buf, "shared_ptr<");
+    size_t len = strlen(buf);
+    while (*owner && *owner != ']')
+        buf[len++] = *owner++;
+    buf[len++] = '>';
+    buf[len] = '\0';
+    return buf;
+}
+
+void dump_stats()
+{
+    console::puts("Slab allocator stats:\n");
+    console::puts("\tname            size  per slab  slabs  active  allocs\n");
+    for (cache* c = caches; c; c = c->next_cache)
+        console::printf("\t%-15s %5d  %8d  %5d  %6d  %6d\n", c->name, c->size, c->objs_per_slab,
+                        c->num_slabs, c->num_active, c->num_allocs);
+}
+
+void init()
+{
+    // everything below the 4MiB boundary after the placement address
+    // is never handed out by the frame allocator (see paging::init)
+    slab_start = memory::align_addr_4m(uint32_t(memory::get_placement_addr()));
+    online = true;
+}
+
+}
@@ -0,0 +1,120 @@
+/* Virtual memory areas.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <vma.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+namespace paging
+{
+
+const vma* vma_tree::find(uintptr_t addr) const
+{
+    auto it = tree.find(addr);
+    return it ? &*it : nullptr;
+}
+
+bool vma_tree::overlaps(uintptr_t start, uintptr_t end) const
+{
+    return start < end && tree.first_overlap(start, end);
+}
+
+bool vma_tree::covers(uintptr_t start, uintptr_t end) const
+{
+    while (start < end) {
+        auto v = find(start);
+        if (!v)
+            return false;
+        start = v->end;
+    }
+    return true;
+}
+
+bool vma_tree::map(uintptr_t start, uintptr_t end, uint32_t prot)
+{
+    if (start >= end)
+        return true;
+    // at most two pieces are left by unmap and one vma is inserted,
+    // so nothing below can fail once the nodes are set aside
+    if (!tree.reserve(3))
+        return false;
+    unmap(start, end);
+
+    // merge with the neighbours
+    if (start) {
+        auto left = tree.find(start - 1);
+        if (left && left->end == start && left->prot == prot) {
+            start = left->start;
+            tree.erase(left);
+        }
+    }
+    auto right = tree.find(end);
+    if (right && right->start == end && right->prot == prot) {
+        end = right->end;
+        tree.erase(right);
+    }
+
+    return bool(tree.insert({start, end, prot}));
+}
+
+bool vma_tree::unmap(uintptr_t start, uintptr_t end)
+{
+    if (start >= end)
+        return true;
+
+    // only the first and the last vma overlapping the range leave a piece
+    if (!tree.reserve(2))
+        return false;
+
+    // cut [start, end) out of every vma overlapping it; the pieces
+    // that are left do not overlap the range any more
+    for (auto it = tree.first_overlap(start, end); it; it = tree.first_overlap(start, end)) {
+        const vma v = *it;
+        tree.erase(it);
+        if (v.start < start)
+            tree.insert({v.start, start, v.prot});
+        if (v.end > end)
+            tree.insert({end, v.end, v.prot});
+    }
+    return true;
+}
+
+bool vma_tree::protect(uintptr_t start, uintptr_t end, uint32_t prot)
+{
+    if (!covers(start, end))
+        return false;
+    return map(start, end, prot);
+}
+
+uintptr_t vma_tree::find_free(size_t len, uintptr_t low, uintptr_t high) const
+{
+    if (high < low + len)
+        return 0;
+
+    // walk down from the highest vma, looking at the gap above each one
+    for (auto it = tree.max(); it && high >= low + len; --it) {
+        if (it->start >= high)
+            continue;
+        if (it->end <= high && high - max(it->end, low) >= len)
+            return high - len;
+        high = it->start;
+    }
+    return high >= low + len ? high - len : 0;
+}
+
+}
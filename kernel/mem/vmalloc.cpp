@@ -0,0 +1,242 @@
+/* Kernel virtual address space allocator.
+   Copyright (C) 2016 Shaun Ren.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <vmalloc.h>
+#include <paging.h>
+#include <console.h>
+#include <lib/klib.h>
+#include <lib/slab_containers.h>
+
+//#define _DEBUG_VMALLOC_
+
+/* free address ranges are kept twice: ordered by address, to merge a freed
+   range with its neighbours, and ordered by size, for best fit. the page
+   tables of the whole range are created by paging::init and linked into every
+   directory, so mapping an area never touches the page directories */
+
+extern "C" paging::page_dir kernel_page_dir;
+
+using paging::PAGE_SIZE;
+using paging::PAGE_SHIFT;
+
+namespace vmalloc
+{
+
+struct free_range
+{
+    uintptr_t start, end;
+};
+
+struct free_size
+{
+    size_t    size;
+    uintptr_t start;
+
+    bool operator<(const free_size& x) const
+    {
+        return size < x.size || (size == x.size && start < x.start);
+    }
+    bool operator==(const free_size& x) const { return size == x.size && start == x.start; }
+    bool operator!=(const free_size& x) const { return !(*this == x); }
+};
+
+enum area_type : uint8_t
+{
+    AREA_ALLOC,                 /* frames owned by the area (vmalloc::alloc) */
+    AREA_IOREMAP                /* somebody else's physical memory (ioremap) */
+};
+
+struct area
+{
+    uintptr_t start, end;       /* [start, end) including the guard page */
+    area_type type;
+};
+
+static slab::interval_tree<free_range>* free_by_addr;
+static slab::rbtree<free_size>*         free_by_size;
+static slab::interval_tree<area>*       areas;
+
+/* statistics */
+static uint32_t num_alloc_pages   = 0;  /* pages mapped by alloc */
+static uint32_t num_ioremap_pages = 0;  /* pages mapped by ioremap */
+static uint32_t num_failures      = 0;
+
+static void insert_free(uintptr_t start, uintptr_t end)
+{
+    free_by_addr->insert({start, end});
+    free_by_size->insert({end - start, start});
+}
+
+static void erase_free(slab::interval_tree<free_range>::const_iterator it)
+{
+    free_by_size->erase(free_by_size->find(free_size{it->end - it->start, it->start}));
+    free_by_addr->erase(it);
+}
+
+// take the smallest free range of at least sz bytes; returns 0 if there is none
+static uintptr_t alloc_range(size_t sz)
+{
+    // rbtree::lower_bound stops at the last node it visited, which can be
+    // the largest one smaller than the key
+    auto it = free_by_size->lower_bound({sz, 0});
+    if (it && it->size < sz)
+        ++it;
+    if (!it)
+        return 0;
+
+    const uintptr_t start = it->start;
+    const size_t    size  = it->size;
+    erase_free(free_by_addr->find(start));
+    if (size > sz)
+        insert_free(start + sz, start + size);
+    return start;
+}
+
+static void release_range(uintptr_t start, uintptr_t end)
+{
+    // merge with the neighbours
+    auto left = free_by_addr->find(start - 1);
+    if (left) {
+        start = left->start;
+        erase_free(left);
+    }
+    auto right = free_by_addr->find(end);
+    if (right) {
+        end = right->end;
+        erase_free(right);
+    }
+    insert_free(start, end);
+}
+
+// reserve an area for npages pages plus the guard page
+static uintptr_t new_area(uint32_t npages, area_type type)
+{
+    const size_t sz = (size_t(npages) << PAGE_SHIFT) + GUARD_SIZE;
+    const uintptr_t start = alloc_range(sz);
+    if (unlikely(!start)) {
+        num_failures++;
+        return 0;
+    }
+    areas->insert({start, start + sz, type});
+#ifdef _DEBUG_VMALLOC_
+    console::printf("VMALLOC: area %#X - %#X\n", start, start + sz);
+#endif
+    return start;
+}
+
+// unmap the pages of an area and give its range back
+static void release_area(slab::interval_tree<area>::const_iterator it)
+{
+    const area a = *it;
+    areas->erase(it);
+
+    paging::unmap_batch batch(&kernel_page_dir);
+    for (uintptr_t addr = a.start; addr < a.end - GUARD_SIZE; addr += PAGE_SIZE) {
+        if (a.type == AREA_ALLOC) {
+            batch.unmap(addr); // frees the frame after the flush
+            num_alloc_pages--;
+        } else {
+            kernel_page_dir.get_page((void*)addr)->value = 0;
+            batch.invalidate(addr);
+            num_ioremap_pages--;
+        }
+    }
+    batch.flush();
+
+    release_range(a.start, a.end);
+}
+
+void* alloc(size_t sz)
+{
+    if (unlikely(!sz))
+        return nullptr;
+    const uint32_t npages = memory::align_addr(sz) >> PAGE_SHIFT;
+    const uintptr_t start = new_area(npages, AREA_ALLOC);
+    if (unlikely(!start))
+        return nullptr;
+
+    num_alloc_pages += npages;
+    if (unlikely(!kernel_page_dir.alloc_pages(start >> PAGE_SHIFT, npages,
+                                              paging::PAGE_PRESENT | paging::PAGE_RW))) {
+        release_area(areas->find(start)); // takes back what was mapped so far
+        num_failures++;
+        return nullptr;
+    }
+    return (void*)start;
+}
+
+void free(void* p)
+{
+    if (unlikely(!p))
+        return;
+    auto it = areas->find(uintptr_t(p));
+    ASSERTH(it && it->start == uintptr_t(p) && it->type == AREA_ALLOC);
+    release_area(it);
+}
+
+void* ioremap(const void* phys_addr, size_t sz, bool cache)
+{
+    // the identity map already covers cached ranges in the low memory; the
+    // others get their own mapping
+    if (cache && size_t(phys_addr) + sz <= paging::KERNEL_IDMAP_SIZE)
+        return paging::phys_to_virt(phys_addr);
+
+    const uint32_t offset = uint32_t(phys_addr) & (PAGE_SIZE - 1);
+    const uint32_t npages = memory::align_addr(sz + offset) >> PAGE_SHIFT;
+    const uintptr_t start = new_area(npages, AREA_IOREMAP);
+    if (unlikely(!start))
+        return nullptr;
+
+    // the slots are never mapped while the area is free, so nothing has to be flushed
+    kernel_page_dir.map_pages(start >> PAGE_SHIFT, (void*)(uint32_t(phys_addr) - offset), npages, false,
+                              paging::PAGE_PRESENT | paging::PAGE_RW |
+                              (cache ? 0 : (paging::PAGE_WRITETHROUGH | paging::PAGE_NOCACHE)));
+    num_ioremap_pages += npages;
+    return (void*)(start + offset);
+}
+
+void iounmap(const void* p)
+{
+    if (uintptr_t(p) < VMALLOC_START || uintptr_t(p) >= VMALLOC_END)
+        return; // in the identity map
+    auto it = areas->find(uintptr_t(p));
+    ASSERTH(it && it->type == AREA_IOREMAP);
+    release_area(it);
+}
+
+void dump_stats()
+{
+    size_t free_total = 0, largest = 0;
+    for (auto& r : *free_by_addr) {
+        free_total += r.end - r.start;
+        if (r.end - r.start > largest)
+            largest = r.end - r.start;
+    }
+    console::printf("vmalloc: %d areas, %d alloc pages, %d ioremap pages, %d failures\n",
+                    areas->size(), num_alloc_pages, num_ioremap_pages, num_failures);
+    console::printf("\t%d KiB free in %d ranges, largest %d KiB\n",
+                    free_total >> 10, free_by_addr->size(), largest >> 10);
+}
+
+void init()
+{
+    free_by_addr = new slab::interval_tree<free_range>;
+    free_by_size = new slab::rbtree<free_size>;
+    areas        = new slab::interval_tree<area>;
+    insert_free(VMALLOC_START, VMALLOC_END);
+}
+
+}
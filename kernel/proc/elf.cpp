@@ -20,10 +20,12 @@
 #include <lib/string.h>
 #include <errno.h>
 #include <algorithm>
+#include <sys/mman.h>
 
 
 using namespace paging;
 using std::max;
+using std::min;
 
 namespace elf
 {
@@ -56,10 +58,11 @@ const char* Elf32_Ehdr::get_str(size_t offset) const
 
 // dir must contain the current kernel stack and buf
 // this function will load dir in the process
-int load(const void* buf, page_dir* dir, Elf32_Addr& entry, void*& brk_start)
+int load(const void* buf, shared_page_dir* sdir, Elf32_Addr& entry, void*& brk_start)
 {
-    if (unlikely(!buf || !dir))
+    if (unlikely(!buf || !sdir || !sdir->dir))
         return -EFAULT;
+    page_dir* const dir = sdir->dir;
 
     const Elf32_Ehdr* hdr = (const Elf32_Ehdr*) buf;
     if (!hdr->valid())
@@ -76,12 +79,17 @@ int load(const void* buf, page_dir* dir, Elf32_Addr& entry, void*& brk_start)
             continue; // ignore
         if (phdr->p_type == PT_LOAD) {
             const auto vaddr_start = phdr->p_vaddr & ~(PAGE_SIZE - 1);
+            const auto file_end = memory::align_addr(phdr->p_vaddr +
+                                                     phdr->p_filesz);
             const auto vaddr_end = memory::align_addr(phdr->p_vaddr +
                                                       phdr->p_memsz);
             if (!dir->alloc_block((void*)vaddr_start,
-                                 vaddr_end - vaddr_start,
+                                 file_end - vaddr_start,
                                  PAGE_PRESENT|PAGE_US|PAGE_RW))
                 return -ENOMEM;
+            // the pages of bss past the file contents are mapped on first touch
+            if (vaddr_end > file_end && !sdir->vmas.map(file_end, vaddr_end, PROT_READ|PROT_WRITE))
+                return -ENOMEM;
             brk_start = (void*) max((uintptr_t)brk_start, vaddr_end);
         } else
             return -EINVAL;
@@ -100,22 +108,40 @@ int load(const void* buf, page_dir* dir, Elf32_Addr& entry, void*& brk_start)
             memcpy((void*)phdr->p_vaddr, (char*)buf + phdr->p_offset, phdr->p_filesz);
         else
             memcpyd((void*)phdr->p_vaddr, (char*)buf + phdr->p_offset, phdr->p_filesz/4);
-        // clear extra memory to 0
+        // clear the rest of the last page with file contents
         if (phdr->p_memsz > phdr->p_filesz) {
-            const auto sz = phdr->p_memsz - phdr->p_filesz;
+            const auto bss_start = phdr->p_vaddr + phdr->p_filesz;
+            const auto sz = min(phdr->p_vaddr + phdr->p_memsz,
+                                memory::align_addr(bss_start)) - bss_start;
             if (unlikely(sz & 3))
                 memset((char*)phdr->p_vaddr + phdr->p_filesz, 0, sz);
             else
                 memsetd((char*)phdr->p_vaddr + phdr->p_filesz, 0, sz/4);
         }
 
-        if (phdr->p_align >= PAGE_SIZE && !(phdr->p_flags & PF_W)) {
-            // set pages as read-only if we are able to
+        const bool readonly = !(phdr->p_flags & PF_W);
+        const pte_t nx = paging::nx_flag((phdr->p_flags & PF_X) ? PROT_EXEC : 0);
+        if (phdr->p_align >= PAGE_SIZE && (readonly || nx)) {
+            // set pages as read-only and/or no-execute if we are able to
+            // (lazily mapped bss pages are not present yet)
             const auto vaddr_start = phdr->p_vaddr & ~(PAGE_SIZE - 1);
-            const auto vaddr_end = memory::align_addr(phdr->p_vaddr +
-                                                      phdr->p_memsz);
-            for (auto addr = vaddr_start; addr < vaddr_end; addr += PAGE_SIZE)
-                dir->get_page((void*)addr)->rw = false;
+            const auto file_end = memory::align_addr(phdr->p_vaddr +
+                                                     phdr->p_filesz);
+            for (auto addr = vaddr_start; addr < file_end; addr += PAGE_SIZE) {
+                if (dir->is_large(addr) && !(addr & (LARGE_PAGE_SIZE - 1)) &&
+                    file_end - addr >= LARGE_PAGE_SIZE) {
+                    const auto idx = page_dir::dir_index(addr);
+                    if (readonly)
+                        dir->entries[idx].rw = false;
+                    dir->entries[idx].value |= nx;
+                    addr += LARGE_PAGE_SIZE - PAGE_SIZE;
+                    continue;
+                }
+                page* pg = dir->get_page((void*)addr, true);
+                if (readonly)
+                    pg->rw = false;
+                pg->value |= nx;
+            }
         }
     }
 
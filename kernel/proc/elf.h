@@ -3585,7 +3585,7 @@ enum
 // this function loads an elf executable in buf
 // dir must contain the current kernel stack and buf
 // this function will load dir in the process
-int load(const void* buf, paging::page_dir* dir, Elf32_Addr& entry, void*& brk_start);
+int load(const void* buf, paging::shared_page_dir* dir, Elf32_Addr& entry, void*& brk_start);
 
 }
 
@@ -17,11 +17,13 @@
 #include <proc.h>
 #include <syscall.h>
 #include <paging.h>
+#include <scratch.h>
+#include <heap.h>
+#include <pool.h>
 #include <isr.h>
 #include <devices/pit.h>
 #include <sys/sched.h>
-#include <lib/rbtree.h>
-#include <lib/linked_list.h>
+#include <lib/slab_containers.h>
 #include <lib/lock.h>
 #include <stdint.h>
 #include <algorithm>
@@ -49,8 +51,8 @@ namespace process
 /* defined in switch.s */
 extern "C" void switch_to_user_curreg();
 extern "C" void switch_to_user(uint32_t esp, uint32_t eip);
-extern "C" void switch_proc(paging::page_dir* dir_phys, proc_state state);
-extern "C" void switch_proc_user(paging::page_dir* dir_phys, proc_state state);
+extern "C" void switch_proc(uint32_t cr3, proc_state state);
+extern "C" void switch_proc_user(uint32_t cr3, proc_state state);
 
 /* defined in save.s */
 extern "C" void save_state(process::proc_state* state);
@@ -64,9 +66,9 @@ static uint32_t sched_latency = 20000000; // ns
 
 static fpu_buf_t fpu_buf __attribute__((aligned(16)));
 
-static rbtree<proc_ptr> proc_list; // list of all processes that's not zombie yet
+static slab::rbtree<proc_ptr> proc_list; // list of all processes that's not zombie yet
 
-static rbtree<proc_ptr> run_queue;
+static slab::rbtree<proc_ptr> run_queue;
 static proc* cur_proc;
 
 // wait queues
@@ -86,11 +88,15 @@ struct sleep_proc
     }
 };
 
-static rbtree<sleep_proc> sleep_queue; // procs that invoked sleep(time)
+static slab::rbtree<sleep_proc> sleep_queue; // procs that invoked sleep(time)
 
 static std::atomic<uint64_t> min_vruntime(0);
 static std::atomic<bool> online(false);
 
+/* statistics */
+static uint32_t num_switches     = 0; /* switches to a different task */
+static uint32_t num_dir_switches = 0; /* ... that had to load another page directory */
+
 desc_tables::tss_entry_struct tss_entry;
 
 // save FPU state
@@ -141,14 +147,33 @@ static inline proc* remove_proc_run(proc* p)
     return p;
 }
 
+bool proc::alloc_kstack()
+{
+    ASSERTH(!kstack);
+    void* frames = paging::alloc_kernel_frames(paging::KERNEL_STACK_ORDER);
+    if (unlikely(!frames))
+        return false;
+    kstack = (uint8_t*) paging::phys_to_virt(frames);
+    scratch::init_arena(kstack);
+    return true;
+}
+
+void proc::free_kstack()
+{
+    if (kstack) {
+        paging::free_frames(paging::virt_to_phys(kstack));
+        kstack = nullptr;
+    }
+}
+
 void proc::remove_from_queue()
 {
     if (cur_queue == RUN_QUEUE)
-        run_queue.erase(rbtree<proc_ptr>::const_iterator((void*)queue_handle));
+        run_queue.erase(slab::rbtree<proc_ptr>::const_iterator((void*)queue_handle));
     else if (cur_queue == SLEEP_QUEUE)
-        sleep_queue.erase(rbtree<sleep_proc>::const_iterator((void*)queue_handle));
+        sleep_queue.erase(slab::rbtree<sleep_proc>::const_iterator((void*)queue_handle));
     else if (cur_queue == EVENT_QUEUE) {
-        auto it = (linked_list<proc_ptr>::iterator*) queue_handle;
+        auto it = (slab::linked_list<proc_ptr>::iterator*) queue_handle;
         it->erase();
         delete it;
     }
@@ -218,8 +243,16 @@ extern "C" void __schedule_force_online()
 static inline void idle_loop()
 {
     online = false;
-    while (run_queue.empty())
-        wait_for_interrupt();
+    if (pool::refill_pending) pool::refill();
+    heap::reclaim(); // nothing else to do, give free heap pages back
+    while (run_queue.empty()) {
+        // zero frames and compact memory for later, one at a time so that
+        // wakeups are not delayed
+        if (paging::prezero_frame() || paging::compact_idle())
+            poll_interrupts();
+        else
+            wait_for_interrupt();
+    }
     online = true;
 }
 
@@ -358,8 +391,17 @@ void schedule(const isr::registers* regs)
     cur_proc->status = proc::RUNNING;
 
     paging::set_page_dir(cur_proc->dir->dir);
+    paging::sync_kernel_entries(cur_proc->dir->dir); // switch.s loads it
 
+    const uint32_t cr3 = cur_proc->dir->dir->cr3();
     if (cur_proc != pold) {
+        num_switches++;
+        if (!cur_proc->dir->dir->loaded())
+            num_dir_switches++; // switch.s skips the reload if the directory is still loaded
+
+        // syscalls enter on the kernel stack of the new task
+        wrmsr(syscall::IA32_SYSENTER_ESP, cur_proc->kstack_top());
+
         // restore FPU state
         if (uintptr_t(cur_proc->state.fpu_buf) % 16 == 0)
             asm volatile ("fxrstor %0" :: "m"(cur_proc->state.fpu_buf) : "memory");
@@ -376,9 +418,15 @@ void schedule(const isr::registers* regs)
     asm volatile ("mov cr0, %0" :: "r"(cr0) : "memory");
 
     if (cur_proc->flags.user)
-        switch_proc_user(cur_proc->dir->dir->phys_addr, cur_proc->state);
+        switch_proc_user(cr3, cur_proc->state);
     else
-        switch_proc(cur_proc->dir->dir->phys_addr, cur_proc->state);
+        switch_proc(cr3, cur_proc->state);
+}
+
+void dump_sched_stats()
+{
+    console::puts("Scheduler stats:\n");
+    console::printf("\ttask switches: %u, page dir switches: %u\n", num_switches, num_dir_switches);
 }
 
 /* sleeping condition variable */
@@ -394,7 +442,7 @@ int condvar::wait(spinlock* lock)
 
     p->status       = proc::WAITING;
     p->cur_queue    = proc::EVENT_QUEUE;
-    p->queue_handle = (void*)new linked_list<proc_ptr>::iterator(this->waiting_procs.push_front({p}));
+    p->queue_handle = (void*)new slab::linked_list<proc_ptr>::iterator(this->waiting_procs.push_front({p}));
 
     if (likely(lock))
         lock->unlock();
@@ -440,49 +488,57 @@ static int _tkill(proc* p, int sig)
 //    system calls
 ////////////////////////////////////////////////////////////////////////////////
 
-int clone(uint32_t flags)
+int clone(uint32_t flags, void* child_stack)
 {
     ASSERTH(cur_proc);
 
     if ((flags & CLONE_CSIGNAL_MASK) >= 32)
         return -EINVAL;
+    // threads share the whole address space with the parent, including
+    // its stack, so they need a stack of their own
+    if ((flags & CLONE_THREAD) && (!(flags & CLONE_VM) || !child_stack))
+        return -EINVAL;
 
     const auto parent_proc = cur_proc;
 
     proc_ptr newproc{new proc(nullptr)};
     if (unlikely(!newproc.p))
         return -ENOMEM;
-
-    if (flags & CLONE_THREAD)
-        newproc->pid = parent_proc->pid;
-
-    sw_barrier(); // we need the vars above to be cloned
-
-    constexpr int stack_table = int((KERNEL_VIRTUAL_BASE - 0x1000) >> PAGE_TABLE_SHIFT);
-    newproc->dir = std::shared_ptr<paging::shared_page_dir>(new paging::shared_page_dir);
-    if (unlikely(!newproc->dir)) {
+    if (unlikely(!newproc->alloc_kstack())) {
         delete newproc.p;
         return -ENOMEM;
     }
-    newproc->dir->dir = parent_proc->dir->dir->clone(flags, stack_table, stack_table);
-    if (unlikely(!newproc->dir->dir)) {
-        delete newproc.p;
-        return -ENOMEM;
+
+    if (flags & CLONE_THREAD) {
+        newproc->pid = parent_proc->pid;
+        // one directory for the whole thread group, so that switching
+        // between its threads doesn't reload CR3
+        newproc->dir = parent_proc->dir;
+    } else {
+        constexpr int stack_table = int((KERNEL_VIRTUAL_BASE - 0x1000) >> PAGE_TABLE_SHIFT);
+        newproc->dir = slab::make_shared_ptr(new paging::shared_page_dir);
+        if (unlikely(!newproc->dir)) {
+            delete newproc.p;
+            return -ENOMEM;
+        }
+        newproc->dir->dir = parent_proc->dir->dir->clone(flags, stack_table, stack_table);
+        if (unlikely(!newproc->dir->dir)) {
+            delete newproc.p;
+            return -ENOMEM;
+        }
+        if (flags & CLONE_VM)
+            newproc->dir->cloned_dir = cur_proc->dir;
+        newproc->dir->vmas      = parent_proc->dir->vmas;
+        newproc->dir->brk_start = parent_proc->dir->brk_start;
+        newproc->dir->brk_end   = parent_proc->dir->brk_end;
+        newproc->dir->stack_bot = parent_proc->dir->stack_bot;
     }
-    if (flags & CLONE_VM)
-        newproc->dir->cloned_dir = cur_proc->dir;
 
-    newproc->flags.user = false; // we will be returning to this function, which is in kernel
     newproc->uid  = parent_proc->uid;
     newproc->nice = parent_proc->nice;
 
     newproc->clone_flags = flags;
 
-    newproc->brk_start = parent_proc->brk_start;
-    newproc->brk_end   = parent_proc->brk_end;
-
-    newproc->stack_bot = parent_proc->stack_bot;
-
     // TODO make new fds unless CLONE_FILES
 
     newproc->parent = (flags & CLONE_PARENT) ? parent_proc->parent : parent_proc;
@@ -491,32 +547,35 @@ int clone(uint32_t flags)
         newproc->next_sibling->prev_sibling = newproc.p;
     newproc->parent->last_child = newproc.p;
 
+    // the child starts in user mode where the parent returns from this syscall,
+    // with the registers sysexit would leave (see syscall/entry.s)
+    const auto frame = parent_proc->get_syscall_frame();
+    const uint32_t user_esp = (flags & CLONE_THREAD) ? uint32_t(child_stack) : frame->user_esp;
+    newproc->flags.user   = true;
+    newproc->state.eflags = EFLAGS_DEFAULT | (uint32_t)Eflags::INT;
+    newproc->state.eip    = frame->user_eip;
+    newproc->state.esp    = user_esp;
+    newproc->state.eax    = 0;
+    newproc->state.ecx    = user_esp;
+    newproc->state.edx    = frame->user_eip;
+    newproc->state.ebx    = frame->user_eip;
+    newproc->state.ebp    = frame->user_esp;
+    newproc->state.esi    = frame->esi;
+    newproc->state.edi    = frame->edi;
+
     if (parent_proc->state.fpu_used)
         fxsave(newproc->state.fpu_buf);
     else
         memcpyd(newproc->state.fpu_buf, parent_proc->state.fpu_buf, sizeof(fpu_buf_t)/4);
     newproc->state.fpu_used = false;
 
-    sw_barrier();
-    save_state(&newproc->state);
-
-    uint32_t esp;
-    asm volatile ("mov %0, esp" : "=g"(esp) :: "memory");
-
-    if (cur_proc == parent_proc) {
-        // parent
-        newproc->state.esp = esp;
-        add_proc_run(newproc);
-        ASSERTH(!(newproc->state.eflags & (uint32_t)Eflags::INT));
-        proc_list.insert(newproc);
-        return newproc->pid;
-    } else {
-        // child
-        return 0;
-    }
+    add_proc_run(newproc);
+    proc_list.insert(newproc);
+    return newproc->tid;
 }
 
 static std::shared_ptr<paging::shared_page_dir> _tmp_dir;
+static uint8_t* _tmp_kstack;
 
 void exit(int status)
 {
@@ -551,13 +610,10 @@ void exit(int status)
         child = next_child;
     }
 
-    // don't save it on stack since we're deleting the current task's kernel stack pages
-    _tmp_dir = cur_proc->dir;
-
-    // free proc stack
-    for (auto stack_addr = (uintptr_t)cur_proc->stack_bot;
-         stack_addr < uintptr_t(PROC_STACK_TOP); stack_addr += 0x1000)
-        _tmp_dir->dir->free_page((void*)stack_addr);
+    // don't save them on stack since we're freeing the current task's kernel stack
+    _tmp_dir    = std::move(cur_proc->dir);
+    _tmp_kstack = cur_proc->kstack;
+    cur_proc->kstack = nullptr;
 
     proc* p = cur_proc;
 
@@ -584,9 +640,13 @@ void exit(int status)
     // switch to the boot kernel stack since the current stack will be gone
     asm volatile ("mov esp, %0" :: "i"((uint32_t)&_kstack_top) : "esp", "memory");
 
-    _tmp_dir->dir->free_kstack_tables();
-
+    // keep the directory loaded until the next task needs another one; if this was
+    // the last thread, the address space goes away here (and switches to the kernel's)
     paging::set_page_dir(&paging::kernel_page_dir);
+    _tmp_dir.reset();
+
+    paging::free_frames(paging::virt_to_phys(_tmp_kstack));
+    _tmp_kstack = nullptr;
 
     sw_barrier();
     schedule();
@@ -635,6 +695,23 @@ int nanosleep(uint64_t ns)
     return ret;
 }
 
+int sched_yield()
+{
+    ASSERTH(cur_proc);
+
+    // queue up behind every other ready task, so that schedule doesn't pick
+    // the current one again while another can run
+    if (run_queue.size() > 1) {
+        proc* p = cur_proc;
+        p->remove_from_queue();
+        p->vruntime = max(p->vruntime, run_queue.max()->p->vruntime + 1);
+        p->queue_handle = (void*)run_queue.insert({p}).handle();
+        p->cur_queue    = proc::RUN_QUEUE;
+    }
+
+    return __schedule();
+}
+
 int tkill(tid_t tid, int sig)
 {
     if (unlikely(sig < 0))
@@ -735,6 +812,8 @@ const uint8_t test_proc1[] = {127, 69, 76, 70, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
 
 const uint8_t test_proc2[] = {127, 69, 76, 70, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 3, 0, 1, 0, 0, 0, 112, 131, 4, 8, 52, 0, 0, 0, 156, 8, 0, 0, 0, 0, 0, 0, 52, 0, 32, 0, 2, 0, 40, 0, 13, 0, 12, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 128, 4, 8, 0, 128, 4, 8, 28, 8, 0, 0, 28, 8, 0, 0, 5, 0, 0, 0, 0, 16, 0, 0, 1, 0, 0, 0, 28, 8, 0, 0, 28, 152, 4, 8, 28, 152, 4, 8, 24, 0, 0, 0, 56, 0, 0, 0, 6, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 85, 137, 229, 232, 136, 2, 0, 0, 232, 19, 3, 0, 0, 93, 195, 0, 141, 76, 36, 4, 131, 228, 240, 255, 113, 252, 85, 137, 229, 87, 86, 83, 81, 131, 236, 84, 104, 106, 133, 4, 8, 232, 194, 3, 0, 0, 90, 89, 106, 0, 104, 0, 202, 154, 59, 232, 244, 3, 0, 0, 199, 4, 36, 106, 133, 4, 8, 232, 168, 3, 0, 0, 91, 94, 106, 0, 104, 0, 202, 154, 59, 49, 219, 232, 216, 3, 0, 0, 199, 4, 36, 0, 0, 0, 0, 232, 236, 3, 0, 0, 199, 4, 36, 0, 0, 0, 0, 232, 224, 3, 0, 0, 199, 4, 36, 126, 133, 4, 8, 232, 116, 3, 0, 0, 199, 69, 172, 154, 133, 4, 8, 199, 69, 176, 157, 133, 4, 8, 199, 69, 180, 160, 133, 4, 8, 199, 69, 184, 163, 133, 4, 8, 199, 69, 188, 166, 133, 4, 8, 199, 69, 192, 143, 133, 4, 8, 199, 69, 196, 145, 133, 4, 8, 199, 69, 200, 147, 133, 4, 8, 199, 69, 204, 149, 133, 4, 8, 199, 69, 208, 151, 133, 4, 8, 199, 69, 212, 153, 133, 4, 8, 199, 69, 216, 156, 133, 4, 8, 199, 69, 220, 159, 133, 4, 8, 199, 69, 224, 162, 133, 4, 8, 199, 69, 228, 165, 133, 4, 8, 232, 134, 3, 0, 0, 95, 255, 116, 133, 172, 232, 252, 2, 0, 0, 199, 4, 36, 124, 133, 4, 8, 232, 240, 2, 0, 0, 232, 107, 3, 0, 0, 131, 196, 16, 131, 248, 2, 116, 14, 141, 101, 240, 137, 216, 89, 91, 94, 95, 93, 141, 97, 252, 195, 80, 80, 106, 0, 104, 0, 148, 53, 119, 232, 7, 3, 0, 0, 199, 4, 36, 0, 0, 0, 0, 232, 139, 3, 0, 0, 141, 184, 32, 50, 0, 0, 137, 198, 137, 60, 36, 232, 123, 3, 0, 0, 131, 196, 16, 57, 199, 116, 23, 131, 236, 12, 187, 1, 0, 0, 0, 104, 168, 133, 4, 8, 232, 146, 2, 0, 0, 131, 196, 16, 235, 170, 198, 134, 4, 16, 0, 0, 65, 198, 134, 5, 16, 0, 0, 10, 131, 236, 12, 198, 134, 6, 16, 0, 0, 10, 198, 134, 7, 16, 0, 0, 0, 129, 198, 4, 16, 0, 0, 86, 232, 98, 2, 0, 0, 131, 196, 16, 233, 119, 255, 255, 255, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 184, 55, 152, 4, 8, 45, 52, 152, 4, 8, 131, 248, 6, 118, 26, 184, 0, 0, 0, 0, 133, 192, 116, 17, 85, 137, 229, 131, 236, 20, 104, 52, 152, 4, 8, 255, 208, 131, 196, 16, 201, 243, 195, 144, 141, 116, 38, 0, 184, 52, 152, 4, 8, 45, 52, 152, 4, 8, 193, 248, 2, 137, 194, 193, 234, 31, 1, 208, 209, 248, 116, 27, 186, 0, 0, 0, 0, 133, 210, 116, 18, 85, 137, 229, 131, 236, 16, 80, 104, 52, 152, 4, 8, 255, 210, 131, 196, 16, 201, 243, 195, 141, 116, 38, 0, 141, 188, 39, 0, 0, 0, 0, 128, 61, 52, 152, 4, 8, 0, 117, 102, 85, 161, 56, 152, 4, 8, 137, 229, 86, 83, 187, 40, 152, 4, 8, 190, 36, 152, 4, 8, 129, 235, 36, 152, 4, 8, 193, 251, 2, 131, 235, 1, 57, 216, 115, 23, 141, 118, 0, 131, 192, 1, 163, 56, 152, 4, 8, 255, 20, 134, 161, 56, 152, 4, 8, 57, 216, 114, 236, 232, 71, 255, 255, 255, 184, 0, 0, 0, 0, 133, 192, 116, 16, 131, 236, 12, 104, 180, 133, 4, 8, 232, 17, 125, 251, 247, 131, 196, 16, 198, 5, 52, 152, 4, 8, 1, 141, 101, 248, 91, 94, 93, 243, 195, 235, 13, 144, 144, 144, 144, 144, 144, 144, 144, 144, 144, 144, 144, 144, 85, 184, 0, 0, 0, 0, 137, 229, 131, 236, 8, 133, 192, 116, 21, 131, 236, 8, 104, 60, 152, 4, 8, 104, 180, 133, 4, 8, 232, 207, 124, 251, 247, 131, 196, 16, 184, 44, 152, 4, 8, 139, 16, 133, 210, 117, 17, 201, 233, 11, 255, 255, 255, 141, 116, 38, 0, 141, 188, 39, 0, 0, 0, 0, 186, 0, 0, 0, 0, 133, 210, 116, 230, 131, 236, 12, 80, 255, 210, 131, 196, 16, 235, 219, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 85, 87, 83, 131, 236, 12, 106, 0, 232, 19, 253, 255, 255, 137, 199, 49, 192, 137, 229, 187, 138, 131, 4, 8, 15, 52, 131, 196, 16, 91, 95, 93, 195, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 144, 161, 28, 152, 4, 8, 131, 248, 255, 116, 39, 85, 137, 229, 83, 187, 28, 152, 4, 8, 131, 236, 4, 141, 118, 0, 141, 188, 39, 0, 0, 0, 0, 131, 235, 4, 255, 208, 139, 3, 131, 248, 255, 117, 244, 131, 196, 4, 91, 93, 243, 195, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 144, 85, 184, 7, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 254, 131, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 182, 0, 0, 0, 0, 141, 188, 39, 0, 0, 0, 0, 85, 184, 8, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 46, 132, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 182, 0, 0, 0, 0, 141, 188, 39, 0, 0, 0, 0, 85, 184, 9, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 94, 132, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 182, 0, 0, 0, 0, 141, 188, 39, 0, 0, 0, 0, 85, 87, 86, 83, 139, 116, 36, 20, 128, 62, 0, 116, 37, 137, 242, 144, 131, 194, 1, 128, 58, 0, 117, 248, 41, 242, 184, 8, 0, 0, 0, 191, 1, 0, 0, 0, 137, 229, 187, 157, 132, 4, 8, 15, 52, 91, 94, 95, 93, 195, 49, 210, 235, 228, 141, 118, 0, 141, 188, 39, 0, 0, 0, 0, 85, 184, 4, 0, 0, 0, 87, 86, 83, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 202, 132, 4, 8, 15, 52, 91, 94, 95, 93, 195, 144, 85, 184, 1, 0, 0, 0, 87, 83, 139, 124, 36, 16, 137, 229, 187, 229, 132, 4, 8, 15, 52, 91, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 85, 184, 2, 0, 0, 0, 83, 137, 229, 187, 0, 133, 4, 8, 15, 52, 91, 93, 195, 141, 182, 0, 0, 0, 0, 141, 188, 39, 0, 0, 0, 0, 85, 184, 3, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 46, 133, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 182, 0, 0, 0, 0, 141, 188, 39, 0, 0, 0, 0, 85, 184, 10, 0, 0, 0, 87, 83, 139, 124, 36, 16, 137, 229, 187, 85, 133, 4, 8, 15, 52, 91, 95, 93, 195, 0, 0, 0, 0, 0, 0, 0, 85, 137, 229, 232, 40, 253, 255, 255, 93, 195, 32, 32, 84, 101, 115, 116, 112, 114, 111, 99, 32, 119, 111, 114, 108, 100, 32, 50, 10, 0, 9, 9, 32, 32, 72, 101, 121, 32, 50, 32, 112, 105, 100, 32, 61, 32, 0, 53, 0, 54, 0, 55, 0, 56, 0, 57, 0, 49, 48, 0, 49, 49, 0, 49, 50, 0, 49, 51, 0, 49, 52, 0, 70, 97, 105, 108, 101, 100, 32, 98, 114, 107, 10, 0, 20, 0, 0, 0, 0, 0, 0, 0, 1, 122, 82, 0, 1, 124, 8, 1, 27, 12, 4, 4, 136, 1, 0, 0, 52, 0, 0, 0, 28, 0, 0, 0, 156, 253, 255, 255, 33, 0, 0, 0, 0, 65, 14, 8, 133, 2, 65, 14, 12, 135, 3, 65, 14, 16, 131, 4, 67, 14, 28, 66, 14, 32, 85, 14, 16, 65, 195, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 0, 0, 0, 68, 0, 0, 0, 84, 0, 0, 0, 132, 250, 255, 255, 134, 1, 0, 0, 0, 68, 12, 1, 0, 71, 16, 5, 2, 117, 0, 70, 15, 3, 117, 112, 6, 16, 7, 2, 117, 124, 16, 6, 2, 117, 120, 16, 3, 2, 117, 116, 2, 242, 10, 193, 12, 1, 0, 65, 195, 65, 198, 65, 199, 65, 197, 67, 12, 4, 4, 65, 11, 0, 0, 0, 0, 0, 0, 0, 52, 0, 0, 0, 160, 0, 0, 0, 136, 253, 255, 255, 35, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 134, 4, 65, 14, 20, 131, 5, 86, 195, 14, 16, 65, 198, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 0, 0, 0, 52, 0, 0, 0, 216, 0, 0, 0, 128, 253, 255, 255, 35, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 134, 4, 65, 14, 20, 131, 5, 86, 195, 14, 16, 65, 198, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 0, 0, 0, 52, 0, 0, 0, 16, 1, 0, 0, 120, 253, 255, 255, 35, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 134, 4, 65, 14, 20, 131, 5, 86, 195, 14, 16, 65, 198, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 0, 0, 0, 52, 0, 0, 0, 72, 1, 0, 0, 112, 253, 255, 255, 54, 0, 0, 0, 0, 65, 14, 8, 133, 2, 65, 14, 12, 135, 3, 65, 14, 16, 134, 4, 65, 14, 20, 131, 5, 106, 10, 195, 14, 16, 65, 198, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 65, 11, 52, 0, 0, 0, 128, 1, 0, 0, 120, 253, 255, 255, 31, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 134, 4, 65, 14, 20, 131, 5, 82, 195, 14, 16, 65, 198, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 0, 0, 0, 40, 0, 0, 0, 184, 1, 0, 0, 96, 253, 255, 255, 25, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 131, 4, 78, 195, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 32, 0, 0, 0, 228, 1, 0, 0, 84, 253, 255, 255, 19, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 131, 3, 74, 195, 14, 8, 65, 197, 14, 4, 0, 52, 0, 0, 0, 8, 2, 0, 0, 80, 253, 255, 255, 35, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 134, 4, 65, 14, 20, 131, 5, 86, 195, 14, 16, 65, 198, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 0, 0, 0, 40, 0, 0, 0, 64, 2, 0, 0, 72, 253, 255, 255, 25, 0, 0, 0, 0, 65, 14, 8, 133, 2, 70, 14, 12, 135, 3, 65, 14, 16, 131, 4, 78, 195, 14, 12, 65, 199, 14, 8, 65, 197, 14, 4, 255, 255, 255, 255, 0, 0, 0, 0, 255, 255, 255, 255, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 71, 67, 67, 58, 32, 40, 71, 78, 85, 41, 32, 53, 46, 49, 46, 48, 0, 0, 46, 115, 104, 115, 116, 114, 116, 97, 98, 0, 46, 105, 110, 105, 116, 0, 46, 116, 101, 120, 116, 0, 46, 102, 105, 110, 105, 0, 46, 114, 111, 100, 97, 116, 97, 0, 46, 101, 104, 95, 102, 114, 97, 109, 101, 0, 46, 99, 116, 111, 114, 115, 0, 46, 100, 116, 111, 114, 115, 0, 46, 106, 99, 114, 0, 46, 100, 97, 116, 97, 0, 46, 98, 115, 115, 0, 46, 99, 111, 109, 109, 101, 110, 116, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 1, 0, 0, 0, 6, 0, 0, 0, 128, 128, 4, 8, 128, 0, 0, 0, 15, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 17, 0, 0, 0, 1, 0, 0, 0, 6, 0, 0, 0, 144, 128, 4, 8, 144, 0, 0, 0, 201, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 23, 0, 0, 0, 1, 0, 0, 0, 6, 0, 0, 0, 96, 133, 4, 8, 96, 5, 0, 0, 10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 29, 0, 0, 0, 1, 0, 0, 0, 50, 0, 0, 0, 106, 133, 4, 8, 106, 5, 0, 0, 74, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 37, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 180, 133, 4, 8, 180, 5, 0, 0, 104, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 47, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 28, 152, 4, 8, 28, 8, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 54, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 36, 152, 4, 8, 36, 8, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 61, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 44, 152, 4, 8, 44, 8, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 66, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 48, 152, 4, 8, 48, 8, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 72, 0, 0, 0, 8, 0, 0, 0, 3, 0, 0, 0, 52, 152, 4, 8, 52, 8, 0, 0, 32, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 77, 0, 0, 0, 1, 0, 0, 0, 48, 0, 0, 0, 0, 0, 0, 0, 52, 8, 0, 0, 17, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 69, 8, 0, 0, 86, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0};
 
+const uint8_t test_proc3[] = {127, 69, 76, 70, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 3, 0, 1, 0, 0, 0, 96, 128, 4, 8, 52, 0, 0, 0, 76, 10, 0, 0, 0, 0, 0, 0, 52, 0, 32, 0, 1, 0, 40, 0, 4, 0, 3, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 128, 4, 8, 0, 128, 4, 8, 49, 10, 0, 0, 49, 10, 0, 0, 5, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 85, 87, 83, 131, 236, 12, 106, 0, 232, 67, 1, 0, 0, 137, 199, 49, 192, 137, 229, 187, 122, 128, 4, 8, 15, 52, 131, 196, 16, 91, 95, 93, 195, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 144, 83, 137, 195, 131, 236, 20, 104, 125, 136, 4, 8, 232, 16, 6, 0, 0, 137, 28, 36, 232, 8, 6, 0, 0, 199, 4, 36, 137, 136, 4, 8, 232, 252, 5, 0, 0, 131, 196, 24, 184, 1, 0, 0, 0, 91, 195, 102, 144, 85, 87, 137, 199, 86, 137, 206, 83, 137, 211, 131, 236, 40, 104, 146, 136, 4, 8, 232, 217, 5, 0, 0, 137, 60, 36, 191, 205, 204, 204, 204, 232, 204, 5, 0, 0, 199, 4, 36, 134, 136, 4, 8, 232, 192, 5, 0, 0, 198, 68, 36, 31, 0, 131, 196, 16, 141, 76, 36, 15, 141, 116, 38, 0, 137, 216, 131, 233, 1, 247, 231, 137, 216, 193, 234, 3, 141, 44, 146, 1, 237, 41, 232, 131, 192, 48, 136, 1, 137, 216, 137, 211, 131, 248, 9, 119, 223, 131, 236, 12, 81, 232, 134, 5, 0, 0, 137, 52, 36, 232, 126, 5, 0, 0, 131, 196, 44, 91, 94, 95, 93, 195, 141, 182, 0, 0, 0, 0, 83, 187, 80, 70, 0, 0, 131, 236, 8, 141, 180, 38, 0, 0, 0, 0, 232, 203, 6, 0, 0, 131, 235, 1, 117, 246, 131, 196, 8, 91, 195, 144, 85, 87, 191, 255, 255, 255, 255, 86, 49, 246, 83, 131, 236, 12, 102, 144, 15, 49, 187, 232, 3, 0, 0, 137, 197, 141, 180, 38, 0, 0, 0, 0, 232, 155, 6, 0, 0, 131, 235, 1, 117, 246, 15, 49, 41, 232, 137, 250, 57, 248, 15, 71, 199, 133, 246, 15, 79, 208, 131, 198, 1, 137, 215, 131, 254, 9, 117, 204, 131, 196, 12, 137, 208, 91, 94, 95, 93, 195, 102, 144, 141, 76, 36, 4, 131, 228, 240, 255, 113, 252, 85, 137, 229, 87, 86, 83, 81, 131, 236, 40, 106, 34, 106, 3, 104, 0, 64, 0, 0, 106, 0, 232, 204, 5, 0, 0, 131, 196, 16, 186, 97, 0, 0, 0, 137, 198, 61, 0, 240, 255, 255, 119, 86, 128, 56, 0, 15, 133, 140, 0, 0, 0, 136, 16, 131, 194, 1, 5, 0, 16, 0, 0, 128, 250, 101, 117, 232, 141, 158, 0, 16, 0, 0, 80, 106, 1, 104, 0, 16, 0, 0, 83, 232, 223, 5, 0, 0, 131, 196, 16, 133, 192, 117, 49, 128, 190, 0, 16, 0, 0, 98, 116, 54, 184, 168, 136, 4, 8, 232, 101, 254, 255, 255, 137, 195, 141, 101, 240, 137, 216, 89, 91, 94, 95, 93, 141, 97, 252, 195, 184, 148, 136, 4, 8, 232, 75, 254, 255, 255, 137, 195, 235, 228, 184, 153, 136, 4, 8, 232, 61, 254, 255, 255, 137, 195, 235, 214, 80, 106, 3, 104, 0, 16, 0, 0, 83, 232, 139, 5, 0, 0, 131, 196, 16, 133, 192, 116, 28, 184, 178, 136, 4, 8, 232, 26, 254, 255, 255, 137, 195, 235, 179, 184, 11, 137, 4, 8, 232, 12, 254, 255, 255, 137, 195, 235, 165, 141, 158, 0, 32, 0, 0, 198, 134, 0, 16, 0, 0, 66, 80, 80, 104, 0, 16, 0, 0, 83, 232, 46, 5, 0, 0, 131, 196, 16, 133, 192, 117, 39, 80, 106, 1, 104, 0, 64, 0, 0, 86, 232, 57, 5, 0, 0, 131, 196, 16, 131, 248, 244, 116, 34, 184, 206, 136, 4, 8, 232, 199, 253, 255, 255, 137, 195, 233, 93, 255, 255, 255, 184, 193, 136, 4, 8, 232, 182, 253, 255, 255, 137, 195, 233, 76, 255, 255, 255, 128, 190, 0, 16, 0, 0, 66, 117, 9, 128, 190, 0, 48, 0, 0, 100, 116, 17, 184, 227, 136, 4, 8, 232, 147, 253, 255, 255, 137, 195, 233, 41, 255, 255, 255, 106, 50, 106, 3, 104, 0, 16, 0, 0, 83, 232, 141, 4, 0, 0, 131, 196, 16, 57, 195, 116, 17, 184, 245, 136, 4, 8, 232, 108, 253, 255, 255, 137, 195, 233, 2, 255, 255, 255, 128, 190, 0, 32, 0, 0, 0, 116, 17, 184, 0, 137, 4, 8, 232, 82, 253, 255, 255, 137, 195, 233, 232, 254, 255, 255, 87, 106, 3, 104, 0, 64, 0, 0, 86, 232, 157, 4, 0, 0, 131, 196, 16, 133, 192, 116, 17, 184, 21, 137, 4, 8, 232, 44, 253, 255, 255, 137, 195, 233, 194, 254, 255, 255, 106, 34, 106, 1, 106, 0, 106, 0, 232, 40, 4, 0, 0, 131, 196, 16, 131, 248, 234, 116, 17, 184, 39, 137, 4, 8, 232, 6, 253, 255, 255, 137, 195, 233, 156, 254, 255, 255, 141, 70, 1, 83, 83, 104, 0, 16, 0, 0, 80, 232, 47, 4, 0, 0, 131, 196, 16, 131, 248, 234, 117, 215, 81, 104, 0, 1, 0, 0, 104, 0, 16, 0, 0, 86, 232, 54, 4, 0, 0, 131, 196, 16, 131, 248, 234, 117, 190, 82, 106, 0, 104, 0, 16, 0, 0, 86, 232, 32, 4, 0, 0, 131, 196, 16, 133, 192, 116, 17, 184, 53, 137, 4, 8, 232, 175, 252, 255, 255, 137, 195, 233, 69, 254, 255, 255, 131, 236, 12, 106, 0, 232, 30, 3, 0, 0, 131, 196, 16, 137, 195, 133, 192, 116, 51, 49, 192, 137, 69, 224, 80, 141, 69, 224, 106, 0, 80, 83, 232, 67, 3, 0, 0, 131, 196, 16, 57, 216, 117, 9, 129, 125, 224, 139, 0, 0, 0, 116, 48, 184, 95, 137, 4, 8, 232, 105, 252, 255, 255, 137, 195, 233, 255, 253, 255, 255, 15, 182, 6, 131, 236, 12, 136, 69, 228, 15, 182, 69, 228, 104, 67, 137, 4, 8, 232, 107, 2, 0, 0, 131, 196, 16, 233, 224, 253, 255, 255, 80, 106, 1, 104, 0, 16, 0, 0, 86, 232, 149, 3, 0, 0, 131, 196, 16, 133, 192, 117, 5, 128, 62, 97, 116, 17, 184, 105, 137, 4, 8, 232, 31, 252, 255, 255, 137, 195, 233, 181, 253, 255, 255, 80, 80, 104, 0, 64, 0, 0, 86, 232, 75, 3, 0, 0, 131, 196, 16, 133, 192, 117, 20, 80, 80, 104, 0, 64, 0, 0, 86, 232, 55, 3, 0, 0, 131, 196, 16, 133, 192, 116, 17, 184, 42, 138, 4, 8, 232, 230, 251, 255, 255, 137, 195, 233, 124, 253, 255, 255, 131, 236, 12, 104, 124, 137, 4, 8, 232, 242, 1, 0, 0, 199, 4, 36, 142, 137, 4, 8, 232, 230, 1, 0, 0, 232, 145, 252, 255, 255, 185, 232, 3, 0, 0, 49, 210, 247, 241, 185, 161, 137, 4, 8, 137, 194, 184, 179, 137, 4, 8, 232, 215, 251, 255, 255, 106, 34, 106, 3, 104, 0, 64, 0, 0, 106, 0, 232, 167, 2, 0, 0, 131, 196, 32, 137, 198, 61, 0, 240, 255, 255, 118, 17, 184, 191, 137, 4, 8, 232, 129, 251, 255, 255, 137, 195, 233, 23, 253, 255, 255, 141, 128, 0, 64, 0, 0, 87, 87, 80, 104, 64, 129, 4, 8, 232, 23, 3, 0, 0, 131, 196, 16, 133, 192, 120, 76, 232, 43, 252, 255, 255, 191, 208, 7, 0, 0, 49, 210, 185, 217, 137, 4, 8, 247, 247, 141, 125, 228, 137, 194, 184, 237, 137, 4, 8, 232, 110, 251, 255, 255, 83, 106, 0, 87, 106, 255, 232, 243, 1, 0, 0, 131, 196, 16, 133, 192, 120, 7, 139, 93, 228, 133, 219, 116, 34, 184, 254, 137, 4, 8, 232, 27, 251, 255, 255, 137, 195, 233, 177, 252, 255, 255, 184, 204, 137, 4, 8, 232, 10, 251, 255, 255, 137, 195, 233, 160, 252, 255, 255, 82, 82, 104, 0, 64, 0, 0, 86, 232, 54, 2, 0, 0, 49, 201, 137, 12, 36, 232, 108, 1, 0, 0, 131, 196, 16, 186, 80, 70, 0, 0, 137, 198, 133, 192, 116, 75, 232, 169, 251, 255, 255, 185, 208, 7, 0, 0, 49, 210, 247, 241, 185, 217, 137, 4, 8, 137, 194, 184, 10, 138, 4, 8, 232, 239, 250, 255, 255, 80, 106, 0, 87, 86, 232, 117, 1, 0, 0, 131, 196, 16, 57, 198, 117, 10, 131, 125, 228, 0, 15, 132, 65, 252, 255, 255, 184, 29, 138, 4, 8, 232, 154, 250, 255, 255, 137, 195, 233, 48, 252, 255, 255, 137, 85, 212, 232, 27, 2, 0, 0, 139, 85, 212, 131, 234, 1, 117, 240, 233, 27, 252, 255, 255, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 102, 144, 85, 184, 7, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 62, 134, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 184, 8, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 110, 134, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 184, 9, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 158, 134, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 87, 86, 83, 139, 116, 36, 20, 128, 62, 0, 116, 43, 137, 242, 144, 131, 194, 1, 128, 58, 0, 117, 248, 41, 242, 184, 8, 0, 0, 0, 191, 1, 0, 0, 0, 137, 229, 187, 221, 134, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 182, 0, 0, 0, 0, 49, 210, 235, 222, 141, 116, 38, 0, 85, 184, 4, 0, 0, 0, 87, 86, 83, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 10, 135, 4, 8, 15, 52, 91, 94, 95, 93, 195, 144, 85, 184, 1, 0, 0, 0, 87, 86, 49, 246, 83, 139, 124, 36, 20, 137, 229, 187, 40, 135, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 118, 0, 85, 184, 2, 0, 0, 0, 83, 137, 229, 187, 64, 135, 4, 8, 15, 52, 91, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 184, 3, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 110, 135, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 184, 10, 0, 0, 0, 87, 83, 139, 124, 36, 16, 137, 229, 187, 149, 135, 4, 8, 15, 52, 91, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 85, 184, 11, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 76, 36, 32, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 194, 135, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 102, 144, 85, 184, 12, 0, 0, 0, 87, 86, 83, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 234, 135, 4, 8, 15, 52, 91, 94, 95, 93, 195, 144, 85, 184, 13, 0, 0, 0, 87, 86, 83, 139, 84, 36, 28, 139, 124, 36, 20, 139, 116, 36, 24, 137, 229, 187, 14, 136, 4, 8, 15, 52, 91, 94, 95, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 184, 14, 0, 0, 0, 83, 137, 229, 187, 48, 136, 4, 8, 15, 52, 91, 93, 195, 141, 180, 38, 0, 0, 0, 0, 141, 182, 0, 0, 0, 0, 85, 87, 191, 0, 33, 0, 0, 86, 83, 139, 116, 36, 24, 139, 68, 36, 20, 131, 238, 4, 137, 6, 184, 1, 0, 0, 0, 137, 229, 187, 100, 136, 4, 8, 15, 52, 133, 192, 117, 16, 88, 255, 208, 49, 255, 49, 192, 137, 229, 187, 120, 136, 4, 8, 15, 52, 91, 94, 95, 93, 195, 109, 109, 97, 112, 32, 116, 101, 115, 116, 58, 32, 0, 32, 102, 97, 105, 108, 101, 100, 10, 0, 9, 0, 109, 109, 97, 112, 0, 109, 112, 114, 111, 116, 101, 99, 116, 32, 115, 112, 108, 105, 116, 0, 114, 101, 97, 100, 32, 111, 110, 108, 121, 0, 109, 112, 114, 111, 116, 101, 99, 116, 32, 109, 101, 114, 103, 101, 0, 109, 117, 110, 109, 97, 112, 32, 115, 112, 108, 105, 116, 0, 109, 112, 114, 111, 116, 101, 99, 116, 32, 111, 118, 101, 114, 32, 97, 32, 104, 111, 108, 101, 0, 109, 117, 110, 109, 97, 112, 32, 110, 101, 105, 103, 104, 98, 111, 117, 114, 115, 0, 109, 109, 97, 112, 32, 102, 105, 120, 101, 100, 0, 109, 109, 97, 112, 32, 102, 105, 120, 101, 100, 32, 122, 101, 114, 111, 32, 102, 105, 108, 108, 0, 109, 112, 114, 111, 116, 101, 99, 116, 32, 114, 101, 102, 105, 108, 108, 101, 100, 0, 98, 97, 100, 32, 97, 114, 103, 117, 109, 101, 110, 116, 115, 0, 109, 112, 114, 111, 116, 101, 99, 116, 32, 110, 111, 110, 101, 0, 111, 109, 102, 103, 32, 80, 82, 79, 84, 95, 78, 79, 78, 69, 32, 105, 115, 32, 114, 101, 97, 100, 97, 98, 108, 101, 10, 0, 80, 82, 79, 84, 95, 78, 79, 78, 69, 0, 80, 82, 79, 84, 95, 78, 79, 78, 69, 32, 99, 111, 110, 116, 101, 110, 116, 115, 0, 109, 109, 97, 112, 32, 116, 101, 115, 116, 32, 112, 97, 115, 115, 101, 100, 10, 0, 116, 97, 115, 107, 32, 115, 119, 105, 116, 99, 104, 32, 99, 111, 115, 116, 58, 10, 0, 32, 99, 121, 99, 108, 101, 115, 32, 112, 101, 114, 32, 99, 97, 108, 108, 10, 0, 121, 105, 101, 108, 100, 32, 97, 108, 111, 110, 101, 0, 116, 104, 114, 101, 97, 100, 32, 115, 116, 97, 99, 107, 0, 99, 108, 111, 110, 101, 32, 116, 104, 114, 101, 97, 100, 0, 32, 99, 121, 99, 108, 101, 115, 32, 112, 101, 114, 32, 115, 119, 105, 116, 99, 104, 10, 0, 116, 104, 114, 101, 97, 100, 32, 116, 111, 32, 116, 104, 114, 101, 97, 100, 0, 116, 104, 114, 101, 97, 100, 32, 101, 120, 105, 116, 0, 112, 114, 111, 99, 101, 115, 115, 32, 116, 111, 32, 112, 114, 111, 99, 101, 115, 115, 0, 112, 114, 111, 99, 101, 115, 115, 32, 101, 120, 105, 116, 0, 109, 117, 110, 109, 97, 112, 0, 0, 46, 115, 104, 115, 116, 114, 116, 97, 98, 0, 46, 116, 101, 120, 116, 0, 46, 114, 111, 100, 97, 116, 97, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 1, 0, 0, 0, 6, 0, 0, 0, 96, 128, 4, 8, 96, 0, 0, 0, 29, 8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0, 0, 0, 0, 0, 0, 0, 17, 0, 0, 0, 1, 0, 0, 0, 50, 0, 0, 0, 125, 136, 4, 8, 125, 8, 0, 0, 180, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 49, 10, 0, 0, 25, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0};
+
 
 void init()
 {
@@ -748,8 +827,7 @@ void init()
     // we use the initial kernel stack for IRQs
     tss_entry.esp0 = (uint32_t)&_irq_stack_top;
 
-    // this is the per-process kernal stack ESP for syscalls
-    wrmsr(syscall::IA32_SYSENTER_ESP, (uint32_t)paging::KERNEL_STACK_TOP);
+    // the kernel stack ESP for syscalls is set on every task switch (see schedule)
 
     asm volatile ("ltr ax" :: "a"(TSS_SEG | 0x03) : "memory"); // flush TSS
 
@@ -758,26 +836,26 @@ void init()
                               fpu_used_handler);
 
     // load (test) init process
-    for (auto test_proc : {test_proc1, test_proc2})
+    for (auto test_proc : {test_proc1, test_proc2, test_proc3})
     {
         auto old_dir = paging::get_current_dir();
         auto new_dir = paging::get_current_dir()->clone();
         new_dir->alloc_block((uint8_t*)PROC_STACK_TOP - 0x1000, 0x1000,
                              paging::PAGE_PRESENT | paging::PAGE_RW | paging::PAGE_US);
-        new_dir->alloc_block((void*)paging::KERNEL_STACK_BOT, paging::KERNEL_STACK_SIZE);
         proc_ptr p{new proc(new paging::shared_page_dir)};
         p->dir->dir = new_dir;
+        ASSERTH(p->alloc_kstack());
         memset(&p->state, 0, sizeof(proc_state));
         fxsave(p->state.fpu_buf);
         p->state.eflags = EFLAGS_DEFAULT | (uint32_t)Eflags::INT;
         p->state.ebp = p->state.esp = (uint32_t)PROC_STACK_TOP;
         p->flags.user = true;
 
-        ASSERTH(!elf::load(test_proc, new_dir, (elf::Elf32_Addr&)p->state.eip, p->brk_start));
+        ASSERTH(!elf::load(test_proc, p->dir.get(), (elf::Elf32_Addr&)p->state.eip, p->dir->brk_start));
         paging::switch_page_dir(old_dir);
-        p->brk_end = p->brk_start;
+        p->dir->brk_end = p->dir->brk_start;
 
-        p->stack_bot = (uint8_t*)PROC_STACK_TOP - 0x1000;
+        p->dir->stack_bot = (uint8_t*)PROC_STACK_TOP - 0x1000;
 
         p->status = proc::READY;
 
@@ -54,7 +54,7 @@ switch_to_user_curreg:
 .switch_to_user_curreg_end:
         ret
 
-;; void switch_proc(page_dir* dir, proc_state state)
+;; void switch_proc(uint32_t cr3, proc_state state)
 global switch_proc
 align 16
 switch_proc:
@@ -63,7 +63,11 @@ switch_proc:
         popa
 
         mov eax, [esp-44]
-        mov cr3, eax            ; page directory
+        mov ecx, cr3
+        cmp eax, ecx
+        je .same_dir            ; threads of a process share the directory
+        mov cr3, eax            ; page directory (the PDPT with PAE)
+.same_dir:
 
         mov ecx, esp
         mov esp, [esp-20]       ; new esp
@@ -83,7 +87,7 @@ switch_proc:
         ret
 
 
-;; void switch_proc_user(page_dir* dir, proc_state state)
+;; void switch_proc_user(uint32_t cr3, proc_state state)
 global switch_proc_user
 align 16
 switch_proc_user:
@@ -101,8 +105,12 @@ switch_proc_user:
         mov eax, [esp-16]
         push eax                ;; EIP
 
+        mov eax, cr3
+        cmp eax, [esp-20]
+        je .same_dir            ; threads of a process share the directory
         mov eax, [esp-20]
-        mov cr3, eax            ; page directory
+        mov cr3, eax            ; page directory (the PDPT with PAE)
+.same_dir:
 
         set_user_datasegs
 
@@ -17,10 +17,13 @@
 ;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
 
 extern syscall_table
-SYSCALL_COUNT equ 11
+SYSCALL_COUNT equ 15
 
 ENOSYS equ 88
 
+KSTACK_BLOCK  equ 0x4000        ; paging::KERNEL_STACK_BLOCK
+SCRATCH_START equ 16            ; scratch::SCRATCH_START
+
 ;; syscall entry point
 ;; syscall id = eax
 ;; args = edi, esi, edx, ecx
@@ -31,6 +34,11 @@ syscall_entry:
         cmp eax, SYSCALL_COUNT
         jge .ret_enosys
 
+        ;; user esp and eip, so that clone can start the child in user mode
+        ;; (process::syscall_frame)
+        push ebx
+        push ebp
+
         ;; push args
         push ecx
         push edx
@@ -60,13 +68,19 @@ align 16
         cli
         add esp, 16
 
+        ;; release everything left in the scratch arena, which is at the
+        ;; beginning of the kernel stack block
+        mov ecx, esp
+        and ecx, ~(KSTACK_BLOCK-1)
+        mov dword [ecx], SCRATCH_START
+
         mov cx, 0x20|0x03       ; user data segment, RPL 3
         mov ds, cx
         mov es, cx
         mov fs, cx
         mov gs, cx
 
-        mov ecx, ebp            ; cdecl non-volatile registers
-        mov edx, ebx
+        pop ecx                 ; user esp
+        pop edx                 ; user eip
         sti
         sysexit
@@ -54,4 +54,8 @@ void* syscall_table[] = {
     (void*)&fs::write,
     (void*)&fs::lseek,
     (void*)&memory::brk,
+    (void*)&memory::mmap,
+    (void*)&memory::munmap,
+    (void*)&memory::mprotect,
+    (void*)&process::sched_yield,
 };
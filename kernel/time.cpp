@@ -20,14 +20,6 @@
 namespace time
 {
 
-// read current CPU time-stamp counter
-static inline uint64_t rdtsc()
-{
-    uint32_t lo, hi;
-    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
-    return lo + (uint64_t(hi) << 32);
-}
-
 void init()
 {
     //for (volatile int i = 1<<18; i--; ) ;
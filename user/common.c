@@ -26,7 +26,7 @@ void nanosleep(uint64_t ns)
 
 int clone(uint32_t flags)
 {
-    return sys_clone(flags);
+    return sys_clone(flags, 0);
 }
 
 pid_t getpid()
@@ -43,3 +43,47 @@ void* _brk(void* addr)
 {
     return (void*) sys_brk(addr);
 }
+
+void* mmap(void* addr, size_t length, int prot, int flags)
+{
+    return (void*) sys_mmap(addr, length, prot, flags);
+}
+
+int munmap(void* addr, size_t length)
+{
+    return sys_munmap(addr, length);
+}
+
+int mprotect(void* addr, size_t length, int prot)
+{
+    return sys_mprotect(addr, length, prot);
+}
+
+int sched_yield()
+{
+    return sys_sched_yield();
+}
+
+int clone_thread(void (*fn)(void), void* stack_top)
+{
+    // the thread starts where clone returns, but on its own stack, so it
+    // can't use this frame: fn is passed on the new stack, and the thread
+    // exits when fn returns
+    uint32_t* sp = (uint32_t*)stack_top;
+    *--sp = (uint32_t)fn;
+
+    int ret = 1; // clone
+    asm volatile (SYSENTER_ASM "\n\t"
+                  "test eax, eax\n\t"
+                  "jnz 2f\n\t"
+                  "pop eax\n\t"
+                  "call eax\n\t"
+                  "xor edi, edi\n\t"
+                  "xor eax, eax\n\t" // exit(0)
+                  SYSENTER_ASM "\n\t"
+                  "2:"
+                  : "+a"(ret)
+                  : "D"(CLONE_VM | CLONE_THREAD), "S"(sp)
+                  : "ebx", "ecx", "edx", "ebp", "memory");
+    return ret;
+}
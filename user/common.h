@@ -4,6 +4,7 @@
 #include <sys/syscall.h>
 #include <sys/sched.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -27,6 +28,11 @@ int clone(uint32_t flags);
 pid_t getpid();
 pid_t waitpid(pid_t pid, int* status, int options);
 void* _brk(void* addr);
+void* mmap(void* addr, size_t length, int prot, int flags);
+int munmap(void* addr, size_t length);
+int mprotect(void* addr, size_t length, int prot);
+int sched_yield();
+int clone_thread(void (*fn)(void), void* stack_top);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,165 @@
+#include "common.h"
+#include <signal.h>
+
+static const size_t PAGE = 0x1000;
+
+static int fail(const char* what)
+{
+    puts("mmap test: ");
+    puts(what);
+    puts(" failed\n");
+    return 1;
+}
+
+static bool is_err(void* p)
+{
+    return (uint32_t)p >= (uint32_t)-4095;
+}
+
+static inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return lo | (uint64_t(hi) << 32);
+}
+
+static void put_uint(uint32_t n)
+{
+    char buf[11];
+    char* s = buf + sizeof(buf) - 1;
+    *s = 0;
+    do {
+        *--s = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    puts(s);
+}
+
+static const int YIELDS = 1000;
+static const int ROUNDS = 8;
+
+static void yield_loop()
+{
+    // more than the other side, so that it never yields to nobody
+    for (int i=0;i<(ROUNDS+1)*YIELDS*2;i++)
+        sched_yield();
+}
+
+// cycles of YIELDS calls to sched_yield: the best of a few rounds, since
+// other processes may run in between
+static uint32_t time_yields()
+{
+    uint32_t best = ~0u;
+    for (int r=0;r<=ROUNDS;r++) {
+        const uint64_t start = rdtsc();
+        for (int i=0;i<YIELDS;i++)
+            sched_yield();
+        const uint32_t cycles = uint32_t(rdtsc() - start);
+        if (r > 0 && cycles < best) // the first round warms up
+            best = cycles;
+    }
+    return best;
+}
+
+static void report(const char* what, uint32_t cycles, const char* unit)
+{
+    puts("\t");
+    puts(what);
+    puts(": ");
+    put_uint(cycles);
+    puts(unit);
+}
+
+// ping-pong with sched_yield between two threads of this process, which
+// share the page directory, and between two processes, which don't; every
+// yield of this side switches there and back
+static int bench_switch()
+{
+    puts("task switch cost:\n");
+    report("yield alone", time_yields() / YIELDS, " cycles per call\n");
+
+    char* stack = (char*)mmap(0, 4*PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+    if (is_err(stack))
+        return fail("thread stack");
+    int status;
+    if (clone_thread(yield_loop, stack + 4*PAGE) < 0)
+        return fail("clone thread");
+    report("thread to thread", time_yields() / (2*YIELDS), " cycles per switch\n");
+    if (waitpid(-1, &status, 0) < 0 || status != 0)
+        return fail("thread exit");
+    munmap(stack, 4*PAGE);
+
+    pid_t pid = clone(0);
+    if (!pid) {
+        yield_loop();
+        return 0;
+    }
+    report("process to process", time_yields() / (2*YIELDS), " cycles per switch\n");
+    if (waitpid(pid, &status, 0) != pid || status != 0)
+        return fail("process exit");
+    return 0;
+}
+
+int main()
+{
+    // four pages of demand-zero memory
+    char* p = (char*)mmap(0, 4*PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+    if (is_err(p))
+        return fail("mmap");
+    for (int i=0;i<4;i++) {
+        if (p[i*PAGE] != 0)
+            return fail("zero fill");
+        p[i*PAGE] = 'a' + i;
+    }
+
+    // read-only in the middle splits the vma in three, and writable merges it again
+    if (mprotect(p + PAGE, PAGE, PROT_READ))
+        return fail("mprotect split");
+    if (p[PAGE] != 'b')
+        return fail("read only");
+    if (mprotect(p + PAGE, PAGE, PROT_READ | PROT_WRITE))
+        return fail("mprotect merge");
+    p[PAGE] = 'B';
+
+    // punch a hole, which mprotect must not paper over
+    if (munmap(p + 2*PAGE, PAGE))
+        return fail("munmap split");
+    if (mprotect(p, 4*PAGE, PROT_READ) != -ENOMEM)
+        return fail("mprotect over a hole");
+    if (p[PAGE] != 'B' || p[3*PAGE] != 'd')
+        return fail("munmap neighbours");
+
+    // and fill it again, with fresh memory
+    if (mmap(p + 2*PAGE, PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED) != p + 2*PAGE)
+        return fail("mmap fixed");
+    if (p[2*PAGE] != 0)
+        return fail("mmap fixed zero fill");
+    if (mprotect(p, 4*PAGE, PROT_READ | PROT_WRITE))
+        return fail("mprotect refilled");
+
+    if (mmap(0, 0, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS) != (void*)-EINVAL ||
+        munmap(p + 1, PAGE) != -EINVAL || mprotect(p, PAGE, 0x100) != -EINVAL)
+        return fail("bad arguments");
+
+    // PROT_NONE memory kills whoever touches it, but keeps its contents
+    if (mprotect(p, PAGE, PROT_NONE))
+        return fail("mprotect none");
+    pid_t pid = clone(0);
+    if (!pid) {
+        volatile char ch = *p;
+        (void)ch;
+        puts("omfg PROT_NONE is readable\n");
+        return 0;
+    }
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid || status != 128 + SIGSEGV)
+        return fail("PROT_NONE");
+    if (mprotect(p, PAGE, PROT_READ) || *p != 'a')
+        return fail("PROT_NONE contents");
+
+    if (munmap(p, 4*PAGE) || munmap(p, 4*PAGE))
+        return fail("munmap");
+
+    puts("mmap test passed\n");
+    return bench_switch();
+}